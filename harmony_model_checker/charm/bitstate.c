@@ -0,0 +1,100 @@
+#include "head.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "global.h"
+#include "bitstate.h"
+#include "hash.h"
+
+// Allocate a bit array of the given size, rounded down to a power of 2
+// (and at least 64)
+struct bitstate *bitstate_new(uint64_t nbits, unsigned int k){
+    assert(k > 0);
+    uint64_t n = 64;
+    while (n * 2 <= nbits) {
+        n *= 2;
+    }
+    struct bitstate *bs = new_alloc(struct bitstate);
+    bs->bits = calloc(n / 64, sizeof(*bs->bits));
+    if (bs->bits == NULL) {
+        panic("bitstate_new: out of memory");
+    }
+    bs->mask = n - 1;
+    bs->k = k;
+    return bs;
+}
+
+// Forget all states.  Not thread-safe.
+void bitstate_clear(struct bitstate *bs){
+    memset((void *) bs->bits, 0, (bs->mask + 1) / 8);
+}
+
+// Set the bits of the state with the given hash.  Returns true if any of
+// them was not set before, that is, if the state is new.  The k bit
+// positions are h1 + i * h2 (double hashing), where h2 is odd so that
+// they are all different.  Two workers that insert the same state at the
+// same time may both find it new, in which case it is explored twice.
+bool bitstate_insert(struct bitstate *bs, uint64_t hash){
+    uint64_t h1 = hash, h2 = hash_mum(hash ^ HASH_P3, HASH_P4) | 1;
+    bool new = false;
+    for (unsigned int i = 0; i < bs->k; i++) {
+        uint64_t bit = (h1 + i * h2) & bs->mask;
+        uint64_t m = (uint64_t) 1 << (bit % 64);
+#ifdef USE_ATOMIC
+        if ((atomic_load_explicit(&bs->bits[bit / 64], memory_order_relaxed) & m) == 0 &&
+                (atomic_fetch_or(&bs->bits[bit / 64], m) & m) == 0) {
+            new = true;
+        }
+#else
+        if ((bs->bits[bit / 64] & m) == 0) {
+            bs->bits[bit / 64] |= m;
+            new = true;
+        }
+#endif
+    }
+    return new;
+}
+
+// Fraction of the bits that are set
+double bitstate_fill(struct bitstate *bs){
+    uint64_t nwords = (bs->mask + 1) / 64, count = 0;
+    for (uint64_t i = 0; i < nwords; i++) {
+        count += __builtin_popcountll(atomic_load(&bs->bits[i]));
+    }
+    return (double) count / (bs->mask + 1);
+}
+
+// e^x for x <= 0, to avoid depending on libm: scale x down, use the
+// Taylor series, and square the result back up
+static double bitstate_exp(double x){
+    unsigned int n = 0;
+    while (x < -0.001) {
+        x /= 2;
+        n++;
+    }
+    double r = 1 + x + x * x / 2 + x * x * x / 6;
+    while (n-- > 0) {
+        r *= r;
+    }
+    return r;
+}
+
+// Estimate how many of the states were missed because their bits had
+// all been set by other states.  When i states have been inserted into m
+// bits, a new state collides with probability (1 - e^(-k i / m))^k.
+// Summing this over the nstates states that were found gives the expected
+// number of omissions (which also bounds the probability of any).
+double bitstate_omission(struct bitstate *bs, unsigned long nstates){
+    double m = (double) bs->mask + 1, k = bs->k, expected = 0;
+    unsigned long step = nstates / 1000 + 1;
+    for (unsigned long i = 0; i < nstates; i += step) {
+        unsigned long n = nstates - i < step ? nstates - i : step;
+        double p = 1, q = 1 - bitstate_exp(-k * i / m);
+        for (unsigned int j = 0; j < bs->k; j++) {
+            p *= q;
+        }
+        expected += n * p;
+    }
+    return expected;
+}
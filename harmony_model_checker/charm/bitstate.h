@@ -0,0 +1,26 @@
+#ifndef SRC_BITSTATE_H
+#define SRC_BITSTATE_H
+
+// Bitstate hashing (charm -b).  Instead of storing the visited states, a
+// state sets k bits in a fixed-size bit array, chosen by k hash functions
+// derived from its 64-bit hash.  A state is considered visited if all its
+// bits are already set, which may be wrong: the exploration can miss part
+// of the state space, but the memory used by the visited set is fixed.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "hashtab.h"    // for hAtomic
+
+struct bitstate {
+    hAtomic(uint64_t) *bits;
+    uint64_t mask;              // #bits - 1 (#bits is a power of 2)
+    unsigned int k;             // #hash functions
+};
+
+struct bitstate *bitstate_new(uint64_t nbits, unsigned int k);
+void bitstate_clear(struct bitstate *bs);
+bool bitstate_insert(struct bitstate *bs, uint64_t hash);
+double bitstate_fill(struct bitstate *bs);
+double bitstate_omission(struct bitstate *bs, unsigned long nstates);
+
+#endif //SRC_BITSTATE_H
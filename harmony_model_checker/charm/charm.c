@@ -11,6 +11,7 @@
 #include <windows.h>
 #else
 #include <sys/param.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sched.h>   //cpu_set_t, CPU_SET
@@ -33,11 +34,18 @@
 // #include "iface/iface.h"
 #include "hashdict.h"
 #include "dfa.h"
+#include "bitstate.h"
+#include "extmem.h"
+#include "checkpoint.h"
+#include "csr.h"
+#include "scc.h"
 #include "thread.h"
 #include "spawn.h"
 
 #define MAX_STEPS       4096        // limit on partial order reduction
 #define WALLOC_CHUNK    (16 * 1024 * 1024)
+#define ROUND_SIZE      10000       // #states evaluated between barriers
+#define MIN_QUOTA       64          // minimum #states per worker per round
 
 static unsigned int oldpid = 0;
 
@@ -65,7 +73,33 @@ struct worker {
     struct step inv_step;        // for evaluating invariants
 
     unsigned int dequeued;      // total number of dequeued states
-    unsigned int enqueued;      // total number of enqueued states
+    hAtomic(unsigned int) enqueued; // total number of enqueued states
+
+    // The frontier of this worker is a range [lo, hi) of indices into
+    // global->graph.nodes.  The owner takes nodes from the front, while
+    // other workers steal from the back.
+#ifdef USE_ATOMIC
+    hAtomic(uint64_t) frontier; // lo and hi packed into one word
+#else
+    mutex_t frontier_lock;
+    unsigned int lo, hi;
+#endif
+    unsigned int quota;         // max #states to evaluate per round
+    unsigned int victim;        // where to start looking for work to steal
+    unsigned int steals;        // #successful steals
+
+    // Partial-order reduction (-p).  onestep() leaves here whether the
+    // last step was invisible to other threads and whether it led to a
+    // new state.
+    bool por_local, por_new;
+    unsigned int reduced;       // #states with only one successor explored
+
+    // In async mode each worker has a queue of states to evaluate
+    // instead.  The owner takes from the front, thieves from the back.
+    mutex_t queue_lock;
+    struct node **queue;
+    unsigned int q_lo, q_hi, q_alloc;
+    hAtomic(unsigned int) completed;    // #states evaluated (async mode)
 
     struct node *results;       // list of resulting states
     unsigned int count;         // number of resulting states
@@ -84,18 +118,52 @@ struct worker {
     struct allocator allocator; // mostly for hashdict
 
     unsigned int *profile;      // one integer for every instruction in the HVM code
+    struct bitstate *bitstate;  // bitstate and swarm mode: visited states
+    struct edge *scratch_edge;  // bitstate, swarm, random walk: edge that may be dropped
+    bool progress;              // bitstate mode: state changed by some step
+    struct failure *stuck;      // bitstate mode: failures of stuck states
+
+    // Swarm mode (see swarm_search()) and random-walk mode (see walk())
+    uint64_t rand;              // random number generator state
+    struct node **dfs;          // depth-first search stack
+    unsigned int dfs_alloc;     // allocated size of dfs stack
+    unsigned int searches;      // #searches or walks completed
 
     // These need to be next to one another
     struct context ctx;
     hvalue_t stack[MAX_CONTEXT_STACK];
 };
 
-// One of these per SCC worker thread
+// One of these per SCC worker thread.  The same threads do the other
+// parallel parts of the graph analysis.
 struct scc_worker {
     struct global *global;     // global state
+    unsigned int index;         // index of worker
     double timeout;
     barrier_t *scc_barrier;
+    struct scc_pool *pool;      // work shared by the SCC workers
+    struct scc_slots slots;     // for allocating slots in the pool
     void *scc_cache;            // for SCC alloc/free
+
+    // Busy waiting detection (see busywait_search())
+    struct busywait_pool *busywait;  // work shared by the workers
+    struct busywait_frame *frames;  // depth-first search stack
+    unsigned int frames_alloc;
+    bool *marks;                // states on the search path
+    unsigned int nmarks;        // size of marks
+    // Failures found, in the order in which they were found
+    struct failure *failures, **failures_last;
+
+    // Component classification (see classify_worker())
+    struct classify *classify;  // work shared by the workers
+    struct step *step;          // for evaluating finally clauses
+    unsigned int nbad;          // #states in bad components
+
+    // Data race detection (see race_worker())
+    struct race_pool *races;    // work shared by the workers
+    struct edge **edges;        // outgoing edges of a state
+    struct access_sig *sigs;    // their access signatures
+    unsigned int edges_alloc;   // allocated size of edges and sigs
 };
 
 #ifdef CACHE_LINE_ALIGNED
@@ -152,6 +220,13 @@ static void *walloc(void *ctx, unsigned int size, bool zero, bool align16){
     return result;
 }
 
+// How much of the memory allocated by walloc() is in use.  The chunks
+// being filled are counted only as far as they have been used.
+static uint64_t walloc_used(struct worker *w){
+    return w->allocated + (w->alloc_ptr - w->alloc_buf) +
+                                    (w->alloc_ptr16 - w->alloc_buf16);
+}
+
 // This is only allowed to release the last thing that was allocated
 static void wfree(void *ctx, void *last, bool align16){
     struct worker *w = ctx;
@@ -349,25 +424,34 @@ static void process_edge(struct worker *w, struct edge *edge, mutex_t *lock, str
 
     mutex_release(lock);
 
-#ifdef DELAY_INSERT
-    // Don't do the forward edge at this time as that would involve locking
-    // the parent node.  Instead assign that task to one of the workers
-    // in the next phase.
-    struct edge **pe = &w->edges[node->id % w->nworkers];
-    edge->fwdnext = *pe;
-    *pe = edge;
-#else
-    if (mutex_try_acquire(node->lock)) {
+    if (w->global->async) {
+        // There is no next phase in async mode, so wait for the lock
+        mutex_acquire(node->lock);
         edge->fwdnext = node->fwd;
         node->fwd = edge;
         mutex_release(node->lock);
     }
     else {
+#ifdef DELAY_INSERT
+        // Don't do the forward edge at this time as that would involve locking
+        // the parent node.  Instead assign that task to one of the workers
+        // in the next phase.
         struct edge **pe = &w->edges[node->id % w->nworkers];
         edge->fwdnext = *pe;
         *pe = edge;
-    }
+#else
+        if (mutex_try_acquire(node->lock)) {
+            edge->fwdnext = node->fwd;
+            node->fwd = edge;
+            mutex_release(node->lock);
+        }
+        else {
+            struct edge **pe = &w->edges[node->id % w->nworkers];
+            edge->fwdnext = *pe;
+            *pe = edge;
+        }
 #endif
+    }
 
     if (!edge->failed && !edge->choosing) {
         // Check invariants
@@ -417,6 +501,153 @@ static void process_edge(struct worker *w, struct edge *edge, mutex_t *lock, str
     }
 }
 
+// Partial-order reduction: remember whether the step just made was local
+// and whether it led to a new state (see do_work1()).  A step is local if
+// it did not touch the shared variables or the stopped contexts, did not
+// print, choose, or fail, and did not allocate a thread identifier.  Such
+// a step commutes with the steps of all other threads and is invisible to
+// invariants.
+static void por_record(struct worker *w, struct edge *edge, struct state *sc, bool new){
+    struct state *old = edge->src->state;
+    w->por_local = edge->ai == NULL && edge->nlog == 0 && !edge->choosing &&
+            !edge->interrupt && !edge->failed && sc->vars == old->vars &&
+            sc->stopbag == old->stopbag && sc->tid_gen == old->tid_gen;
+    w->por_new = new;
+}
+
+// Bitstate mode: the visited set is a bit array and the graph is not kept.
+// Only new states are stored, for the frontier and to be able to trace
+// back to the initial state, together with the edge that led to them.
+// A failing edge and its destination are kept as well.  The edge comes in
+// a scratch area and is copied if needed.  Returns whether the state is new.
+// In random-walk and external-memory mode there is no visited set and every
+// state that differs from the source state counts as new.  In external-
+// memory mode those go to disk, and only failing edges are kept.
+static bool bitstate_edge(struct worker *w, struct edge *scratch, struct state *sc,
+                            bool infinite_loop, struct node **results){
+    struct global *global = w->global;
+    struct node *node = scratch->src;
+    unsigned int size = state_size(sc);
+    bool changed = size != state_size(node->state) ||
+                        memcmp(sc, node->state, size) != 0;
+    if (changed) {
+        w->progress = true;
+    }
+    bool new = w->bitstate == NULL ? changed :
+                        bitstate_insert(w->bitstate, state_hash(sc));
+
+    // Check the invariants against a temporary node until we know
+    // whether the state needs to be kept
+    unsigned int inv = 0;
+    if (!scratch->failed && !scratch->choosing && global->ninvs != 0) {
+        struct node tmp;
+        memset(&tmp, 0, sizeof(tmp));
+        tmp.state = sc;
+        if (new) {
+            inv = check_invariants(global, &tmp, &tmp, &w->inv_step);
+        }
+        if (inv == 0) {
+            inv = check_invariants(global, &tmp, node, &w->inv_step);
+        }
+    }
+    if (global->extmem != NULL) {
+        if (changed) {
+            extmem_candidate(global->extmem, node, scratch, sc, state_hash(sc));
+        }
+        if (!scratch->failed && inv == 0) {
+            return new;
+        }
+    }
+    else if (!new && !scratch->failed && inv == 0) {
+        return false;
+    }
+
+    // In swarm and random-walk mode a search releases its states when it
+    // is done, so allocate the node, the state, and the edge in one block
+    unsigned int esize = sizeof(struct edge) + scratch->nlog * sizeof(hvalue_t);
+    struct node *next;
+    struct edge *edge;
+    if (global->swarm != 0 || global->walks != 0 || global->extmem != NULL) {
+        unsigned int nsize = (sizeof(struct node) + size + 7) & ~7;
+        next = malloc(nsize + esize);
+        memset(next, 0, sizeof(struct node));
+        edge = (struct edge *) ((char *) next + nsize);
+    }
+    else {
+        next = walloc(w, sizeof(struct node) + size, true, false);
+        edge = walloc(w, esize, false, false);
+    }
+    next->state = (struct state *) &next[1];
+    memcpy(next->state, sc, size);
+    memcpy(edge, scratch, esize);
+    edge->dst = next;
+    edge->fwdnext = edge->bwdnext = NULL;
+
+    next->initialized = true;
+    next->failed = edge->failed;
+    next->to_parent = edge;
+    next->len = node->len + 1;
+    next->steps = node->steps + edge->nsteps;
+    next->next = *results;
+    *results = next;
+    w->count++;
+    w->enqueued++;
+
+    if (edge->failed) {
+        struct failure *f = new_alloc(struct failure);
+        f->type = infinite_loop ? FAIL_TERMINATION : FAIL_SAFETY;
+        f->edge = edge;
+        f->next = w->failures;
+        w->failures = f;
+    }
+    if (inv != 0) {
+        struct failure *f = new_alloc(struct failure);
+        f->type = FAIL_INVARIANT;
+        f->edge = edge;
+        f->next = w->failures;
+        f->address = VALUE_TO_PC(inv);
+        w->failures = f;
+    }
+    return new;
+}
+
+// Bitstate mode: no step can change the given state.  Without the graph,
+// this is the one kind of component that can be analyzed.  If only eternal
+// threads are left, it is a final state and the finally clauses and the
+// behavior are checked.  Otherwise it is a deadlock.
+static void bitstate_stuck(struct worker *w, struct node *node){
+    struct global *global = w->global;
+    struct failure *f;
+    if (value_state_all_eternal(node->state) &&
+                    value_ctx_all_eternal(node->state->stopbag)) {
+        node->final = true;
+        if (global->dfa != NULL &&
+                    !dfa_is_final(global->dfa, node->state->dfa_state)) {
+            f = new_alloc(struct failure);
+            f->type = FAIL_BEHAVIOR;
+            f->edge = node->to_parent;
+            f->next = w->stuck;
+            w->stuck = f;
+        }
+        unsigned int fin = check_finals(global, node, &w->inv_step);
+        if (fin != 0) {
+            f = new_alloc(struct failure);
+            f->type = FAIL_FINALLY;
+            f->edge = node->to_parent;
+            f->address = VALUE_TO_PC(fin);
+            f->next = w->stuck;
+            w->stuck = f;
+        }
+    }
+    else {
+        f = new_alloc(struct failure);
+        f->type = FAIL_TERMINATION;
+        f->edge = node->to_parent;
+        f->next = w->stuck;
+        w->stuck = f;
+    }
+}
+
 static bool onestep(
     struct worker *w,       // thread info
     struct node *node,      // starting node
@@ -763,7 +994,8 @@ static bool onestep(
     }
 
     // Allocate edge now
-    struct edge *edge = walloc(w, sizeof(struct edge) + step->nlog * sizeof(hvalue_t), false, false);
+    struct edge *edge = w->scratch_edge != NULL ? w->scratch_edge :
+        walloc(w, sizeof(struct edge) + step->nlog * sizeof(hvalue_t), false, false);
     edge->src = node;
     edge->ctx = ctx;
     edge->choice = choice_copy;
@@ -777,6 +1009,14 @@ static bool onestep(
     edge->choosing = choosing;
     edge->failed = step->ctx->failed;
 
+    if (w->scratch_edge != NULL) {
+        bool new = bitstate_edge(w, edge, sc, infinite_loop, results);
+        if (global->por) {
+            por_record(w, edge, sc, new);
+        }
+        return true;
+    }
+
     if (step->ctx->failed) {
         struct failure *f = new_alloc(struct failure);
         f->type = infinite_loop ? FAIL_TERMINATION : FAIL_SAFETY;
@@ -789,10 +1029,14 @@ static bool onestep(
     unsigned int size = state_size(sc);
     mutex_t *lock;
     bool new;
-    struct dict_assoc *hn = dict_find_lock(w->visited, &w->allocator,
-                sc, size, &new, &lock);
+    struct dict_assoc *hn = dict_find_lock_hashed(w->visited, &w->allocator,
+                sc, size, state_hash(sc), &new, &lock);
     edge->dst = (struct node *) &hn[1];
 
+    if (global->por) {
+        por_record(w, edge, sc, new);
+    }
+
 #ifdef NO_PROCESSING
     if (new) {
         edge->dst->state = (struct state *) &edge->dst[1];
@@ -1928,66 +2172,506 @@ static void enum_loc(
 
 #endif // notdef
 
-enum busywait { BW_ESCAPE, BW_RETURN, BW_VISITED };
-static enum busywait is_stuck(
-    struct node *start,
-    struct node *node,
-    hvalue_t ctx,
-    bool change
-) {
-	if (node->component != start->component) {
-		return BW_ESCAPE;
-	}
-	if (node->visited) {
-		return BW_VISITED;
-	}
-    change = change || (node->state->vars != start->state->vars);
-	node->visited = true;
-	enum busywait result = BW_ESCAPE;
-    for (struct edge *edge = node->fwd; edge != NULL; edge = edge->fwdnext) {
-        if (edge->ctx == ctx) {
-			if (edge->dst == node) {
-				node->visited = false;
-				return BW_ESCAPE;
-			}
-			if (edge->dst == start) {
-				if (!change) {
-					node->visited = false;
-					return BW_ESCAPE;
-				}
-				result = BW_RETURN;
-			}
-			else {
-				enum busywait bw = is_stuck(start, edge->dst, edge->after, change);
-				switch (bw) {
-				case BW_ESCAPE:
-					node->visited = false;
-					return BW_ESCAPE;
-				case BW_RETURN:
-					result = BW_RETURN;
-					break;
-				case BW_VISITED:
-					break;
-				default:
-					assert(false);
-				}
-			}
-        }
-    }
-	node->visited = false;
+// Add to the failures found by an SCC worker
+static void scc_worker_fail(struct scc_worker *w, struct failure *f){
+    f->next = NULL;
+    *w->failures_last = f;
+    w->failures_last = &f->next;
+}
+
+// Move the failures found by the SCC workers to the failure heap, in the
+// order of the workers, so the outcome does not depend on scheduling
+static void scc_worker_failures(struct global *global, struct scc_worker *workers){
+    for (unsigned int i = 0; i < global->nworkers; i++) {
+        struct scc_worker *w = &workers[i];
+        struct failure *f = w->failures, *next;
+        for (; f != NULL; f = next) {
+            next = f->next;
+            minheap_insert(global->failures, f);
+        }
+        w->failures = NULL;
+        w->failures_last = &w->failures;
+    }
+}
+
+enum busywait { BW_ESCAPE, BW_RETURN };
+
+// Busy waiting detection.  A context busy waits in a state if, whatever
+// it does, it stays within the state's component and can only get back
+// to the state after a change to the shared variables, that is, if it
+// needs another thread to make progress.  The components with more than
+// one state are checked in parallel by the SCC workers.  The states of
+// each component are listed consecutively, so that each worker can keep
+// its marks of the states on its search path in a small array indexed by
+// the position of a state within its component.
+struct busywait_pool {
+    struct component *components;
+    unsigned int *first;        // start of each component in members
+    uint32_t *members;          // states of the components with > 1 state
+    uint32_t *rank;             // position of each state within its component
+#ifdef USE_ATOMIC
+    hAtomic(unsigned int) next; // next component to check
+#else
+    mutex_t lock;
+    unsigned int next;
+#endif
+};
+
+#define BUSYWAIT_BATCH  64      // #components a worker takes at a time
+
+struct busywait_frame {
+    uint32_t id;                // state
+    hvalue_t ctx;               // context followed in this state
+    bool change;                // shared variables changed on the path
+    bool returned;              // found a way back to the start
+    struct edge *edge;          // next edge to look at
+};
+
+// See if context ctx of state start busy waits.  This is a depth-first
+// search of the paths of the context, from start, that do not visit a
+// state twice.  It escapes as soon as one of them leaves the component,
+// gets stuck in a state, or gets back to start without a change to the
+// shared variables.
+static enum busywait busywait_search(struct scc_worker *w, uint32_t start, hvalue_t ctx){
+    struct global *global = w->global;
+    struct busywait_pool *bw = w->busywait;
+    struct node **nodes = global->graph.nodes;
+    struct node *sn = nodes[start];
+    enum busywait result = BW_ESCAPE;
+
+    unsigned int sp = 1;
+    struct busywait_frame *f = &w->frames[0];
+    f->id = start;
+    f->ctx = ctx;
+    f->change = f->returned = false;
+    f->edge = sn->fwd;
+    w->marks[bw->rank[start]] = true;
+
+    while (sp > 0) {
+        f = &w->frames[sp - 1];
+
+        // Find the next edge of the context
+        struct edge *edge;
+        uint32_t dst = 0;
+        while (f->edge != NULL && f->edge->ctx != f->ctx) {
+            f->edge = f->edge->fwdnext;
+        }
+        if ((edge = f->edge) != NULL) {
+            dst = edge->dst->id;
+            f->edge = edge->fwdnext;
+        }
+
+        // All edges done: go back unless there was no way back to start
+        if (edge == NULL) {
+            if (!f->returned) {
+                break;
+            }
+            w->marks[bw->rank[f->id]] = false;
+            if (--sp == 0) {
+                result = BW_RETURN;
+            }
+            else {
+                w->frames[sp - 1].returned = true;
+            }
+            continue;
+        }
+
+        if (dst == f->id) {
+            break;
+        }
+        if (dst == start) {
+            if (!f->change) {
+                break;
+            }
+            f->returned = true;
+            continue;
+        }
+        struct node *next = nodes[dst];
+        if (next->component != sn->component) {
+            break;
+        }
+        if (w->marks[bw->rank[dst]]) {
+            continue;
+        }
+
+        // Follow the edge
+        if (sp == w->frames_alloc) {
+            w->frames_alloc *= 2;
+            w->frames = realloc(w->frames, w->frames_alloc * sizeof(*w->frames));
+            f = &w->frames[sp - 1];
+        }
+        struct busywait_frame *nf = &w->frames[sp++];
+        nf->id = dst;
+        nf->ctx = edge->after;
+        nf->change = f->change || next->state->vars != sn->state->vars;
+        nf->returned = false;
+        nf->edge = next->fwd;
+        w->marks[bw->rank[dst]] = true;
+    }
+
+    // Clear the marks left after escaping
+    while (sp > 0) {
+        w->marks[bw->rank[w->frames[--sp].id]] = false;
+    }
     return result;
 }
 
-static void detect_busywait(struct minheap *failures, struct node *node){
-	for (unsigned int i = 0; i < node->state->bagsize; i++) {
-		if (is_stuck(node, node, state_contexts(node->state)[i], false) == BW_RETURN) {
-			struct failure *f = new_alloc(struct failure);
-			f->type = FAIL_BUSYWAIT;
-			f->edge = node->to_parent;
-			minheap_insert(failures, f);
-			// break;
-		}
-	}
+// List the states of each component with more than one state
+static void busywait_prepare(struct busywait_pool *bw, struct global *global, struct component *components){
+    unsigned int n = global->graph.size, total = 0;
+    bw->components = components;
+    bw->first = malloc((global->ncomponents + 1) * sizeof(*bw->first));
+    for (unsigned int i = 0; i < global->ncomponents; i++) {
+        bw->first[i] = total;
+        if (components[i].size > 1) {
+            total += components[i].size;
+        }
+    }
+    bw->first[global->ncomponents] = total;
+    bw->members = malloc(total * sizeof(*bw->members));
+    bw->rank = malloc(n * sizeof(*bw->rank));
+    unsigned int *fill = calloc(global->ncomponents, sizeof(*fill));
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned int c = global->graph.nodes[i]->component;
+        if (components[c].size > 1) {
+            bw->rank[i] = fill[c]++;
+            bw->members[bw->first[c] + bw->rank[i]] = i;
+        }
+    }
+    free(fill);
+#ifdef USE_ATOMIC
+    atomic_init(&bw->next, 0);
+#else
+    mutex_init(&bw->lock);
+    bw->next = 0;
+#endif
+}
+
+static void busywait_worker(void *arg){
+    struct scc_worker *w = arg;
+    struct global *global = w->global;
+    struct busywait_pool *bw = w->busywait;
+
+    w->frames_alloc = 64;
+    w->frames = malloc(w->frames_alloc * sizeof(*w->frames));
+    for (;;) {
+#ifdef USE_ATOMIC
+        unsigned int c = atomic_fetch_add(&bw->next, BUSYWAIT_BATCH);
+#else
+        mutex_acquire(&bw->lock);
+        unsigned int c = bw->next;
+        bw->next += BUSYWAIT_BATCH;
+        mutex_release(&bw->lock);
+#endif
+        if (c >= global->ncomponents) {
+            break;
+        }
+        unsigned int last = c + BUSYWAIT_BATCH;
+        if (last > global->ncomponents) {
+            last = global->ncomponents;
+        }
+        for (; c < last; c++) {
+            unsigned int size = bw->components[c].size;
+            if (size < 2) {
+                continue;
+            }
+            if (size > w->nmarks) {
+                free(w->marks);
+                w->marks = calloc(size, sizeof(*w->marks));
+                w->nmarks = size;
+            }
+            for (unsigned int i = bw->first[c]; i < bw->first[c + 1]; i++) {
+                struct node *node = global->graph.nodes[bw->members[i]];
+                for (unsigned int j = 0; j < node->state->bagsize; j++) {
+                    if (busywait_search(w, bw->members[i], state_contexts(node->state)[j]) == BW_RETURN) {
+                        struct failure *f = new_alloc(struct failure);
+                        f->type = FAIL_BUSYWAIT;
+                        f->edge = node->to_parent;
+                        scc_worker_fail(w, f);
+                    }
+                }
+            }
+        }
+    }
+    free(w->frames);
+    free(w->marks);
+    w->marks = NULL;
+    w->nmarks = 0;
+    barrier_wait(w->scc_barrier);
+}
+
+// Data race detection.  The workers check the states in batches, using
+// graph_has_data_race(), and keep track of the first state in the graph
+// table found to have a data race.  Batches beyond that state are skipped.
+// The data races of the first state are reported afterwards in the same
+// way as by a sequential scan, so the outcome does not depend on the
+// number of workers.
+struct race_pool {
+#ifdef USE_ATOMIC
+    hAtomic(unsigned int) next;     // next state to check
+    hAtomic(unsigned int) first;    // first state with a data race so far
+#else
+    mutex_t lock;
+    unsigned int next, first;
+#endif
+};
+
+#define RACE_BATCH      256     // #states a worker takes at a time
+
+static void race_found(struct race_pool *rp, unsigned int id){
+#ifdef USE_ATOMIC
+    unsigned int first = atomic_load(&rp->first);
+    while (id < first && !atomic_compare_exchange_weak(&rp->first, &first, id))
+        ;
+#else
+    mutex_acquire(&rp->lock);
+    if (id < rp->first) {
+        rp->first = id;
+    }
+    mutex_release(&rp->lock);
+#endif
+}
+
+// Make room for the edges of a state and their signatures
+static void race_reserve(struct scc_worker *w, unsigned int n){
+    if (n > w->edges_alloc) {
+        w->edges_alloc = n < 16 ? 16 : 2 * n;
+        w->edges = realloc(w->edges, w->edges_alloc * sizeof(*w->edges));
+        w->sigs = realloc(w->sigs, w->edges_alloc * sizeof(*w->sigs));
+    }
+}
+
+static void race_worker(void *arg){
+    struct scc_worker *w = arg;
+    struct global *global = w->global;
+    struct race_pool *rp = w->races;
+
+    for (;;) {
+#ifdef USE_ATOMIC
+        unsigned int id = atomic_fetch_add(&rp->next, RACE_BATCH);
+        unsigned int first = atomic_load(&rp->first);
+#else
+        mutex_acquire(&rp->lock);
+        unsigned int id = rp->next;
+        rp->next += RACE_BATCH;
+        unsigned int first = rp->first;
+        mutex_release(&rp->lock);
+#endif
+        unsigned int last = id + RACE_BATCH;
+        if (last > global->graph.size) {
+            last = global->graph.size;
+        }
+        if (last > first) {
+            last = first;
+        }
+        if (id >= last) {
+            break;
+        }
+        for (; id < last; id++) {
+            unsigned int n = 0;
+            for (struct edge *e = global->graph.nodes[id]->fwd; e != NULL; e = e->fwdnext) {
+                race_reserve(w, n + 1);
+                w->edges[n++] = e;
+            }
+            if (graph_has_data_race(w->edges, n, w->sigs)) {
+                race_found(rp, id);
+                break;
+            }
+        }
+    }
+    free(w->edges);
+    free(w->sigs);
+    w->edges = NULL;
+    w->sigs = NULL;
+    w->edges_alloc = 0;
+    barrier_wait(w->scc_barrier);
+}
+
+// Classification of the components, and the checks of the states in the
+// final components.  Each worker takes a range of the graph table and
+// goes through the following passes, separated by barriers:
+//
+//  1. Count the states of each component, find its lowest numbered state,
+//     and see if it has an edge to another component.
+//  2. See if all states of each component have the same shared variables
+//     as the lowest numbered one, and only eternal threads.
+//  3. Fill in the components table (by ranges of components).
+//  4. Check the states in final components against the DFA and the
+//     finally clauses.
+//  5. If nothing was found, count the states in bad components.
+//
+// Failures are kept in the order of the states and merged in the order of
+// the workers (see scc_worker_failures()), just like a sequential scan.
+// Without atomic operations worker 0 does all the work.
+struct classify {
+    unsigned int nworkers;              // #workers taking part
+    struct component *components;
+    hAtomic(unsigned int) *size;        // #states of each component
+    hAtomic(uint32_t) *rep;             // lowest numbered state of each
+    hAtomic(bool) *good;                // component has a way out
+    hAtomic(bool) *mixed;               // states not all the same
+    bool *failed;                       // per worker: failures in pass 4
+};
+
+static void classify_barrier(struct scc_worker *w){
+    if (w->classify->nworkers > 1) {
+        barrier_wait(w->scc_barrier);
+    }
+}
+
+static void classify_worker(void *arg){
+    struct scc_worker *w = arg;
+    struct global *global = w->global;
+    struct classify *cl = w->classify;
+    struct graph *graph = &global->graph;
+    struct node **nodes = global->graph.nodes;
+    unsigned int start = (uint64_t) global->graph.size * w->index / cl->nworkers;
+    unsigned int finish = (uint64_t) global->graph.size * (w->index + 1) / cl->nworkers;
+
+    // Pass 1: size, lowest numbered state, and a way out
+    for (unsigned int i = start; i < finish; i++) {
+        struct node *node = nodes[i];
+        if (graph->csr != NULL) {
+            node->component = graph->csr->component[i];
+        }
+        unsigned int c = node->component;
+		assert(c < global->ncomponents);
+#ifdef USE_ATOMIC
+        atomic_fetch_add_explicit(&cl->size[c], 1, memory_order_relaxed);
+        uint32_t rep = atomic_load_explicit(&cl->rep[c], memory_order_relaxed);
+        while (i < rep && !atomic_compare_exchange_weak(&cl->rep[c], &rep, i))
+            ;
+        if (atomic_load_explicit(&cl->good[c], memory_order_relaxed)) {
+            continue;
+        }
+#else
+        cl->size[c]++;
+        if (i < cl->rep[c]) {
+            cl->rep[c] = i;
+        }
+        if (cl->good[c]) {
+            continue;
+        }
+#endif
+        bool out = false;
+        struct graph_iter it;
+        uint32_t next;
+        graph_succ(graph, i, &it);
+        while (graph_next(&it, &next)) {
+            if (graph_component(graph, next) != c) {
+                out = true;
+                break;
+            }
+        }
+        if (out) {
+#ifdef USE_ATOMIC
+            atomic_store_explicit(&cl->good[c], true, memory_order_relaxed);
+#else
+            cl->good[c] = true;
+#endif
+        }
+    }
+    classify_barrier(w);
+
+    // Pass 2: all the same shared state and only eternal threads
+    for (unsigned int i = start; i < finish; i++) {
+        struct node *node = nodes[i];
+        unsigned int c = node->component;
+#ifdef USE_ATOMIC
+        struct node *rep = nodes[atomic_load_explicit(&cl->rep[c], memory_order_relaxed)];
+#else
+        struct node *rep = nodes[cl->rep[c]];
+#endif
+        if (node->state->vars != rep->state->vars ||
+                    !value_state_all_eternal(node->state) ||
+                    !value_ctx_all_eternal(node->state->stopbag)) {
+#ifdef USE_ATOMIC
+            atomic_store_explicit(&cl->mixed[c], true, memory_order_relaxed);
+#else
+            cl->mixed[c] = true;
+#endif
+        }
+    }
+    classify_barrier(w);
+
+    // Pass 3: components that have only one shared state and only eternal
+    // threads are good because it means all its threads are blocked
+    unsigned int first = (uint64_t) global->ncomponents * w->index / cl->nworkers;
+    unsigned int last = (uint64_t) global->ncomponents * (w->index + 1) / cl->nworkers;
+    for (unsigned int c = first; c < last; c++) {
+        struct component *comp = &cl->components[c];
+#ifdef USE_ATOMIC
+        comp->size = atomic_load_explicit(&cl->size[c], memory_order_relaxed);
+        comp->rep = nodes[atomic_load_explicit(&cl->rep[c], memory_order_relaxed)];
+        comp->good = atomic_load_explicit(&cl->good[c], memory_order_relaxed);
+        comp->all_same = !atomic_load_explicit(&cl->mixed[c], memory_order_relaxed);
+#else
+        comp->size = cl->size[c];
+        comp->rep = nodes[cl->rep[c]];
+        comp->good = cl->good[c];
+        comp->all_same = !cl->mixed[c];
+#endif
+        assert(comp->size > 0);
+        if (!comp->good && comp->all_same) {
+            comp->good = true;
+            comp->final = true;
+        }
+    }
+    classify_barrier(w);
+
+    // Pass 4: look for states in final components
+    for (unsigned int i = start; i < finish; i++) {
+        struct node *node = nodes[i];
+        if (!cl->components[node->component].final) {
+            continue;
+        }
+        node->final = true;
+        if (global->dfa != NULL &&
+                    !dfa_is_final(global->dfa, node->state->dfa_state)) {
+            struct failure *f = new_alloc(struct failure);
+            f->type = FAIL_BEHAVIOR;
+            f->edge = node->to_parent;
+            scc_worker_fail(w, f);
+        }
+
+        // Check "finally" clauses
+        unsigned int fin = check_finals(global, node, w->step);
+        if (fin != 0) {
+            struct failure *f = new_alloc(struct failure);
+            f->type = FAIL_FINALLY;
+            f->edge = node->to_parent;
+            f->address = VALUE_TO_PC(fin);
+            scc_worker_fail(w, f);
+        }
+    }
+    cl->failed[w->index] = w->failures != NULL;
+    classify_barrier(w);
+
+    // Pass 5: count the states that are in bad components, unless there
+    // are other failures already
+    w->nbad = 0;
+    for (unsigned int i = 0; i < cl->nworkers; i++) {
+        if (cl->failed[i]) {
+            classify_barrier(w);
+            return;
+        }
+    }
+    for (unsigned int i = start; i < finish; i++) {
+        struct node *node = nodes[i];
+        if (!cl->components[node->component].good) {
+            w->nbad++;
+            struct failure *f = new_alloc(struct failure);
+            f->type = FAIL_TERMINATION;
+            if (node->fwd != NULL && node->fwd->fwdnext == NULL) {
+                f->edge = node->fwd;
+            }
+            else {
+                f->edge = node->to_parent;
+            }
+            scc_worker_fail(w, f);
+        }
+    }
+    classify_barrier(w);
 }
 
 static int node_cmp(void *n1, void *n2){
@@ -2008,6 +2692,29 @@ static int fail_cmp(void *f1, void *f2){
     return node_cmp(fail1->edge->dst, fail2->edge->dst);
 }
 
+// Swarm and random-walk mode: next number from the worker's xorshift
+// generator
+static inline uint64_t swarm_random(struct worker *w){
+    w->rand ^= w->rand << 13;
+    w->rand ^= w->rand >> 7;
+    w->rand ^= w->rand << 17;
+    return w->rand;
+}
+
+// See if the next step of the given context is worth trying as the only
+// step out of a state (partial-order reduction).  Steps start at a
+// breakable instruction unless the thread has just been spawned or was
+// interrupted for some other reason, so this is mostly a quick filter.
+// Whether the step is really local is decided afterwards in onestep().
+static bool por_candidate(struct global *global, hvalue_t ctx){
+    struct context *cc = value_get(ctx, NULL);
+    if (cc->extended && ctx_trap_pc(cc) != 0 && !cc->interruptlevel) {
+        return false;
+    }
+    struct instr *instr = &global->code.instrs[cc->pc];
+    return !instr->breakable && !instr->choose;
+}
+
 void do_work1(struct worker *w, struct node *node, unsigned int level){
     if (node->failed) {
         return;
@@ -2025,19 +2732,66 @@ void do_work1(struct worker *w, struct node *node, unsigned int level){
         hvalue_t *vals = value_get(s, &size);
         size /= sizeof(hvalue_t);
         assert(size > 0);
+
+        // In swarm mode, start at a random choice
+        unsigned int start = w->global->swarm != 0 ? swarm_random(w) % size : 0;
         for (unsigned int i = 0; i < size; i++) {
             make_step(
                 w,
                 node,
                 state->choosing,
-                vals[i],
+                vals[(start + i) % size],
                 1,
                 &w->results
             );
         }
     }
     else {
+        // In swarm mode, expand the contexts in random order
+        unsigned int order[MAX_CONTEXT_BAG];
         for (unsigned int i = 0; i < state->bagsize; i++) {
+            order[i] = i;
+        }
+        if (w->global->swarm != 0) {
+            for (unsigned int i = state->bagsize; i > 1; i--) {
+                unsigned int j = swarm_random(w) % i, tmp = order[i - 1];
+                order[i - 1] = order[j];
+                order[j] = tmp;
+            }
+        }
+
+        // With partial-order reduction, first try a single context whose
+        // next step may be local.  If it is, and it leads to a new state,
+        // then that step alone is enough.  Requiring a new state is the
+        // cycle proviso: every cycle in the reduced graph contains a state
+        // that was fully expanded.  Otherwise expand the other contexts.
+        unsigned int tried = state->bagsize;
+        if (w->global->por && state->bagsize > 1) {
+            for (unsigned int k = 0; k < state->bagsize; k++) {
+                unsigned int i = order[k];
+                if (por_candidate(w->global, state_contexts(state)[i])) {
+                    make_step(
+                        w,
+                        node,
+                        state_contexts(state)[i],
+                        0,
+                        multiplicities(state)[i],
+                        &w->results
+                    );
+                    if (w->por_local && w->por_new) {
+                        w->reduced++;
+                        return;
+                    }
+                    tried = i;
+                    break;
+                }
+            }
+        }
+        for (unsigned int k = 0; k < state->bagsize; k++) {
+            unsigned int i = order[k];
+            if (i == tried) {
+                continue;
+            }
             assert(VALUE_TYPE(state_contexts(state)[i]) == VALUE_CONTEXT);
             make_step(
                 w,
@@ -2051,47 +2805,254 @@ void do_work1(struct worker *w, struct node *node, unsigned int level){
     }
 }
 
-static void do_work(struct worker *w){
-    struct global *global = w->global;
-    unsigned int todo_count = 5;
+#define FRONTIER(lo, hi)    (((uint64_t) (lo) << 32) | (hi))
+#define FRONTIER_LO(f)      ((unsigned int) ((f) >> 32))
+#define FRONTIER_HI(f)      ((unsigned int) (f))
 
-    for (;;) {
+// Set the frontier of the given worker.  Only called by the owner or
+// by the coordinator between barriers.
+static void frontier_set(struct worker *w, unsigned int lo, unsigned int hi){
 #ifdef USE_ATOMIC
-        unsigned int next = atomic_fetch_add(&global->atodo, todo_count);
-#else // USE_ATOMIC
-        mutex_acquire(&global->todo_lock);
-        unsigned int next = global->todo;
-        global->todo += todo_count;
-        mutex_release(&global->todo_lock);
-#endif // USE_ATOMIC
-
-        for (unsigned int i = 0; i < todo_count; i++, next++) {
-            // printf("W%d %d %d\n", w->index, next, global->graph.size);
-            if (next >= global->graph.size) {
-                return;
-            }
-            w->dequeued++;
-            do_work1(w, global->graph.nodes[next], 0);
-        }
-
-        if (next >= global->goal) {
-            break;
-        }
-    }
+    atomic_store(&w->frontier, FRONTIER(lo, hi));
+#else
+    mutex_acquire(&w->frontier_lock);
+    w->lo = lo;
+    w->hi = hi;
+    mutex_release(&w->frontier_lock);
+#endif
 }
 
-void process_results(struct global *global, struct worker *w){
-    struct failure *f;
-    while ((f = w->failures) != NULL) {
-        w->failures = f->next;
-        minheap_insert(global->failures, f);
-    }
+// Number of states left in the frontier of the given worker
+static unsigned int frontier_size(struct worker *w){
+#ifdef USE_ATOMIC
+    uint64_t f = atomic_load(&w->frontier);
+    return FRONTIER_HI(f) - FRONTIER_LO(f);
+#else
+    mutex_acquire(&w->frontier_lock);
+    unsigned int size = w->hi - w->lo;
+    mutex_release(&w->frontier_lock);
+    return size;
+#endif
 }
 
-static void worker(void *arg){
-    struct worker *w = arg;
+// Get the range of states left in the frontier of the given worker
+static void frontier_get(struct worker *w, unsigned int *lo, unsigned int *hi){
+#ifdef USE_ATOMIC
+    uint64_t f = atomic_load(&w->frontier);
+    *lo = FRONTIER_LO(f);
+    *hi = FRONTIER_HI(f);
+#else
+    mutex_acquire(&w->frontier_lock);
+    *lo = w->lo;
+    *hi = w->hi;
+    mutex_release(&w->frontier_lock);
+#endif
+}
+
+// Take up to n states from the front of the worker's own frontier.
+// Returns the number of states taken, starting at *first.
+static unsigned int frontier_take(struct worker *w, unsigned int n, unsigned int *first){
+#ifdef USE_ATOMIC
+    uint64_t f = atomic_load(&w->frontier);
+    for (;;) {
+        unsigned int lo = FRONTIER_LO(f), hi = FRONTIER_HI(f);
+        if (lo == hi) {
+            return 0;
+        }
+        if (n > hi - lo) {
+            n = hi - lo;
+        }
+        if (atomic_compare_exchange_weak(&w->frontier, &f, FRONTIER(lo + n, hi))) {
+            *first = lo;
+            return n;
+        }
+    }
+#else
+    mutex_acquire(&w->frontier_lock);
+    if (n > w->hi - w->lo) {
+        n = w->hi - w->lo;
+    }
+    *first = w->lo;
+    w->lo += n;
+    mutex_release(&w->frontier_lock);
+    return n;
+#endif
+}
+
+// Steal the back half of the frontier of another worker and make it
+// the frontier of worker w, whose own frontier is empty.
+static bool frontier_steal(struct worker *w, struct worker *victim){
+    unsigned int lo, hi, n;
+#ifdef USE_ATOMIC
+    uint64_t f = atomic_load(&victim->frontier);
+    for (;;) {
+        lo = FRONTIER_LO(f);
+        hi = FRONTIER_HI(f);
+        if (lo == hi) {
+            return false;
+        }
+        n = (hi - lo + 1) / 2;
+        if (atomic_compare_exchange_weak(&victim->frontier, &f, FRONTIER(lo, hi - n))) {
+            break;
+        }
+    }
+#else
+    mutex_acquire(&victim->frontier_lock);
+    lo = victim->lo;
+    hi = victim->hi;
+    n = (hi - lo + 1) / 2;
+    victim->hi -= n;
+    mutex_release(&victim->frontier_lock);
+    if (n == 0) {
+        return false;
+    }
+#endif
+    frontier_set(w, hi - n, hi);
+    w->steals++;
+    return true;
+}
+
+// Evaluate states from the worker's own frontier until its quota for
+// this round runs out.  When the frontier is empty, steal from other
+// workers.  New states go to w->results and end up in this worker's
+// frontier for the next layer.
+#ifdef USE_ATOMIC
+
+// Fail-fast mode: see if the worker has found a safety violation or an
+// invariant violation
+static bool first_failure_found(struct worker *w){
+    for (struct failure *f = w->failures; f != NULL; f = f->next) {
+        if (f->type == FAIL_SAFETY || f->type == FAIL_INVARIANT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // USE_ATOMIC
+
+static void do_work(struct worker *w){
+    struct global *global = w->global;
+    unsigned int todo_count = 5;
+    unsigned int done = 0;
+
+    while (done < w->quota) {
+#ifdef USE_ATOMIC
+        // In fail-fast mode, stop as soon as any worker has found a failure
+        if (global->first_failure && atomic_load(&global->stop)) {
+            break;
+        }
+#endif
+        unsigned int first;
+        unsigned int n = frontier_take(w, todo_count, &first);
+        if (n == 0) {
+            // Look for a victim, starting where we left off last time
+            bool stolen = false;
+            for (unsigned int i = 0; i < w->nworkers && !stolen; i++) {
+                w->victim = (w->victim + 1) % w->nworkers;
+                if (w->victim != w->index) {
+                    stolen = frontier_steal(w, &w->workers[w->victim]);
+                }
+            }
+            if (!stolen) {
+                break;
+            }
+            continue;
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            // printf("W%d %d %d\n", w->index, first + i, global->graph.size);
+            w->dequeued++;
+            struct node *node = global->graph.nodes[first + i];
+            w->progress = false;
+            do_work1(w, node, 0);
+
+            if (global->bitstate != NULL && !w->progress && !node->failed) {
+                bitstate_stuck(w, node);
+            }
+#ifdef USE_ATOMIC
+            if (global->first_failure && first_failure_found(w)) {
+                atomic_store(&global->stop, true);
+            }
+#endif
+        }
+        done += n;
+    }
+}
+
+void process_results(struct global *global, struct worker *w){
+    struct failure *f;
+    while ((f = w->failures) != NULL) {
+        w->failures = f->next;
+        minheap_insert(global->failures, f);
+    }
+}
+
+// Memory budget (--max-memory): the budget is nearly used up.  From now on
+// the search continues as in bitstate mode: the visited states are only
+// remembered in a bit array, of which a sixteenth of the budget is
+// allocated, and of the edges only those to the parents of new states are
+// kept.  The states already visited are entered in the bit array.  The
+// expanded states are checked for being stuck now, as the graph analysis
+// that would otherwise do this is not possible without all the edges.
+// Called by the coordinator between rounds.
+static void memory_degrade(struct worker *w){
+    struct global *global = w->global;
+    struct bitstate *bs = bitstate_new(global->max_memory / 2, 3);
+
+    // The states in the frontiers have not been expanded yet
+    unsigned int *lo = malloc(global->nworkers * sizeof(*lo));
+    unsigned int *hi = malloc(global->nworkers * sizeof(*hi));
+    unsigned int min_lo = global->graph.size;
+    for (unsigned int i = 0; i < global->nworkers; i++) {
+        frontier_get(&w->workers[i], &lo[i], &hi[i]);
+        if (lo[i] < hi[i] && lo[i] < min_lo) {
+            min_lo = lo[i];
+        }
+    }
+
+    for (unsigned int j = 0; j < global->graph.size; j++) {
+        struct node *node = global->graph.nodes[j];
+        bitstate_insert(bs, state_hash(node->state));
+        if (node->failed) {
+            continue;
+        }
+        bool expanded = true;
+        for (unsigned int i = 0; j >= min_lo && i < global->nworkers; i++) {
+            if (lo[i] <= j && j < hi[i]) {
+                expanded = false;
+                break;
+            }
+        }
+        bool stuck = expanded;
+        for (struct edge *e = node->fwd; e != NULL && stuck; e = e->fwdnext) {
+            stuck = e->dst == node;
+        }
+        if (stuck) {
+            bitstate_stuck(w, node);
+        }
+    }
+    free(lo);
+    free(hi);
+
+    // The new states of this layer are not in the graph yet
+    global->degraded = global->graph.size;
+    for (unsigned int i = 0; i < global->nworkers; i++) {
+        struct worker *w2 = &w->workers[i];
+        for (struct node *node = w2->results; node != NULL; node = node->next) {
+            bitstate_insert(bs, state_hash(node->state));
+        }
+        global->degraded += w2->count;
+        w2->bitstate = bs;
+        w2->scratch_edge = malloc(sizeof(struct edge) + MAX_PRINT * sizeof(hvalue_t));
+    }
+    global->bitstate = bs;
+}
+
+static void worker(void *arg){
+    struct worker *w = arg;
     struct global *global = w->global;
     bool done = false;
+    unsigned int layer_start = 0;       // worker 0: first node of the layer
 
 #ifdef CPU_SET
     if (w->index == 0) {
@@ -2128,6 +3089,13 @@ static void worker(void *arg){
             break;
         }
 
+        // All workers are waiting, so the graph is complete up to the
+        // frontier.  See if it is time to write a checkpoint.
+        if (w->index == 0 && global->checkpoint != NULL && global->bitstate == NULL &&
+                    global->layer_done && minheap_empty(global->failures)) {
+            checkpoint_layer(global->checkpoint, global, layer_start);
+        }
+
         // (first) parallel phase starts now
 		// printf("WORKER %d starting epoch %d\n", w->index, epoch);
         before = after;
@@ -2166,41 +3134,67 @@ static void worker(void *arg){
         if (w->index == 1 % global->nworkers) {
             dict_grow_prepare(w->visited);
         }
-        if (w->index == 2 % global->nworkers) {
-            dict_grow_prepare(global->values);
+        for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+            if (w->index == (2 + i) % global->nworkers) {
+                dict_grow_prepare(global->values[i]);
+            }
         }
 
         // Only the coordinator (worker 0) does this
         if (w->index == 0 % global->nworkers) {
-            // End of a layer in the Kripke structure?
 #ifdef USE_ATOMIC
-            unsigned int todo = atomic_load(&global->atodo);
-#else
-            unsigned int todo = global->todo;
-#endif
-            if (todo > global->graph.size) {
-#ifdef USE_ATOMIC
-                atomic_store(&global->atodo, global->graph.size);
-#else
-                global->todo = global->graph.size;
+            // In fail-fast mode, the rest of the layer is skipped once a
+            // failure has been found.  The new states are still added to
+            // the graph as they may be on the path to the failure.
+            if (global->first_failure && atomic_load(&global->stop)) {
+                for (unsigned int i = 0; i < global->nworkers; i++) {
+                    frontier_set(&w->workers[i], 0, 0);
+                }
+            }
 #endif
-                todo = global->graph.size;
+
+            // See if the memory budget is nearly or completely used up
+            if (global->max_memory != 0 && !global->out_of_memory) {
+                uint64_t allocated = global->allocated;
+                for (unsigned int i = 0; i < global->nworkers; i++) {
+                    allocated += walloc_used(&w->workers[i]);
+                }
+                if (global->bitstate == NULL && allocated >= global->max_memory / 10 * 8) {
+                    memory_degrade(w);
+                }
+                if (allocated >= global->max_memory) {
+                    global->out_of_memory = true;
+                    global->unexplored = 0;
+                    for (unsigned int i = 0; i < global->nworkers; i++) {
+                        global->unexplored += frontier_size(&w->workers[i]) +
+                                                w->workers[i].count;
+                        frontier_set(&w->workers[i], 0, 0);
+                    }
+                }
+            }
+
+            // End of a layer in the Kripke structure?
+            unsigned int left = 0;
+            for (unsigned int i = 0; i < global->nworkers; i++) {
+                left += frontier_size(&w->workers[i]);
             }
-            // printf("SEQ: todo=%u size=%u\n", todo, global->graph.size);
-            global->layer_done = todo == global->graph.size;
+            global->layer_done = left == 0;
             if (global->layer_done) {
                 global->diameter++;
                 // printf("Diameter %d\n", global->diameter);
 
-                // Grow the graph table.
+                // Grow the graph table.  The new states of each worker
+                // form its frontier for the next layer.
                 unsigned int total = 0;
                 for (unsigned int i = 0; i < global->nworkers; i++) {
                     struct worker *w2 = &w->workers[i];
                     w2->node_id = global->graph.size + total;
+                    frontier_set(w2, w2->node_id, w2->node_id + w2->count);
                     total += w2->count;
                 }
 
                 // The threads completed producing the next layer of nodes in the graph.
+                layer_start = global->graph.size;
                 graph_add_multiple(&global->graph, total);
                 assert(global->graph.size <= global->graph.alloc_size);
 
@@ -2209,13 +3203,11 @@ static void worker(void *arg){
                     process_results(global, &w->workers[i]);
                 }
 
-                if (!minheap_empty(global->failures)) {
+                if (!minheap_empty(global->failures) || global->out_of_memory) {
                     // Pretend we're done
-#ifdef USE_ATOMIC
-                    atomic_store(&global->atodo, global->graph.size);
-#else
-                    global->todo = global->graph.size;
-#endif
+                    for (unsigned int i = 0; i < global->nworkers; i++) {
+                        frontier_set(&w->workers[i], 0, 0);
+                    }
                 }
 
                 // Worker 0 is the coordinator and may need to go do
@@ -2225,16 +3217,9 @@ static void worker(void *arg){
                 }
             }
 
-            if (global->graph.size - todo > 10000) {
-                global->goal = todo + 10000;
-            }
-            else {
-                global->goal = global->graph.size;
-            }
-
             // Compute how much table space is in use
             global->allocated = global->graph.size * sizeof(struct node *) +
-                dict_allocated(w->visited) + dict_allocated(global->values);
+                dict_allocated(w->visited) + values_allocated(global->values);
         }
 
         after = gettime();
@@ -2249,7 +3234,9 @@ static void worker(void *arg){
         before = after;
 
 		// printf("WORKER %d make stable %d %u %u\n", w->index, epoch, w->count, w->node_id);
-        dict_make_stable(global->values, w->index);
+        for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+            dict_make_stable(global->values[i], w->index);
+        }
         dict_make_stable(w->visited, w->index);
 
         if (global->layer_done) {
@@ -2270,67 +3257,761 @@ static void worker(void *arg){
     }
 }
 
-static void scc_worker(void *arg){
-    struct scc_worker *w = arg;
+#ifdef USE_ATOMIC
+
+// Move the new states in w->results onto the worker's queue
+static void queue_push_results(struct worker *w){
+    mutex_acquire(&w->queue_lock);
+    if (w->q_hi + w->count > w->q_alloc) {
+        // Make room, either by shifting the queue or growing it
+        unsigned int size = w->q_hi - w->q_lo;
+        if (size + w->count > w->q_alloc / 2) {
+            w->q_alloc = (size + w->count + 1) * 2;
+            w->queue = realloc(w->queue, w->q_alloc * sizeof(*w->queue));
+        }
+        memmove(w->queue, &w->queue[w->q_lo], size * sizeof(*w->queue));
+        w->q_lo = 0;
+        w->q_hi = size;
+    }
+    struct node *node;
+    while ((node = w->results) != NULL) {
+        w->results = node->next;
+        w->queue[w->q_hi++] = node;
+    }
+    w->count = 0;
+    mutex_release(&w->queue_lock);
+}
+
+// Take up to n states from the front of the worker's queue
+static unsigned int queue_take(struct worker *w, struct node **batch, unsigned int n){
+    mutex_acquire(&w->queue_lock);
+    if (n > w->q_hi - w->q_lo) {
+        n = w->q_hi - w->q_lo;
+    }
+    memcpy(batch, &w->queue[w->q_lo], n * sizeof(*batch));
+    w->q_lo += n;
+    mutex_release(&w->queue_lock);
+    return n;
+}
+
+// Steal the back half of the queue of another worker.  The two locks
+// are acquired in order of worker index to prevent deadlock.
+static bool queue_steal(struct worker *w, struct worker *victim){
+    struct worker *first = w->index < victim->index ? w : victim;
+    struct worker *second = w->index < victim->index ? victim : w;
+    mutex_acquire(&first->queue_lock);
+    mutex_acquire(&second->queue_lock);
+    unsigned int n = (victim->q_hi - victim->q_lo + 1) / 2;
+    if (n > 0) {
+        assert(w->q_lo == w->q_hi);
+        if (n > w->q_alloc) {
+            w->q_alloc = n * 2;
+            w->queue = realloc(w->queue, w->q_alloc * sizeof(*w->queue));
+        }
+        victim->q_hi -= n;
+        memcpy(w->queue, &victim->queue[victim->q_hi], n * sizeof(*w->queue));
+        w->q_lo = 0;
+        w->q_hi = n;
+        w->steals++;
+    }
+    mutex_release(&second->queue_lock);
+    mutex_release(&first->queue_lock);
+    return n > 0;
+}
+
+// See if all work is done.  Every state is counted as enqueued before
+// the state that produced it is counted as completed, and the counters
+// only go up.  So if the completed states (read first) add up to all
+// the states enqueued (read second), there is nothing left to do.  The
+// counters of other workers are updated concurrently, so they are read
+// with atomic loads.
+static bool async_quiescent(struct worker *w){
+    unsigned int completed = 0, enqueued = 1;   // include the initial state
+    for (unsigned int i = 0; i < w->nworkers; i++) {
+        completed += atomic_load(&w->workers[i].completed);
+    }
+    for (unsigned int i = 0; i < w->nworkers; i++) {
+        enqueued += atomic_load(&w->workers[i].enqueued);
+    }
+    return completed == enqueued;
+}
+
+// Worker in async mode.  There are no rounds and no barriers: a worker
+// evaluates states from its own queue, steals from other workers when it
+// runs out, and stops when all work is done or a failure has been found.
+static void async_worker(void *arg){
+    struct worker *w = arg;
     struct global *global = w->global;
-    mutex_acquire(&global->todo_enter);
-    for (;;) {
-        if (global->scc_todo == NULL) {
-            global->scc_nwaiting++;
-            if (global->scc_nwaiting == global->nworkers) {
-                mutex_release(&global->todo_wait);
-                break;
+    struct node *batch[5];
+
+    while (!atomic_load(&global->stop)) {
+        unsigned int n = queue_take(w, batch, sizeof(batch) / sizeof(batch[0]));
+        if (n == 0) {
+            // Look for a victim, starting where we left off last time
+            bool stolen = false;
+            for (unsigned int i = 0; i < w->nworkers && !stolen; i++) {
+                w->victim = (w->victim + 1) % w->nworkers;
+                if (w->victim != w->index) {
+                    stolen = queue_steal(w, &w->workers[w->victim]);
+                }
             }
-            mutex_release(&global->todo_enter);
-            mutex_acquire(&global->todo_wait);
-            if (global->scc_nwaiting == global->nworkers) {
-                mutex_release(&global->todo_wait);
-                break;
+            if (!stolen) {
+                if (async_quiescent(w)) {
+                    break;
+                }
+                thread_yield();
+            }
+            continue;
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            w->dequeued++;
+            do_work1(w, batch[i], 0);
+        }
+        queue_push_results(w);
+
+        // The new states have been counted, so now count these
+        atomic_fetch_add(&w->completed, n);
+
+        if (w->failures != NULL) {
+            atomic_store(&global->stop, true);
+        }
+    }
+
+    // Wait for the other workers to finish
+    barrier_wait(w->end_barrier);
+}
+
+// In async mode states are not evaluated in breadth-first order, so the
+// paths to the initial state are not necessarily the shortest.  Number
+// the states in breadth-first order and fix up to_parent, len, and steps
+// so that counterexamples are as short as in the layered mode.
+static void async_bfs(struct global *global, struct node *root){
+    struct graph *graph = &global->graph;
+    graph->size = 0;
+    graph_add(graph, root);
+    root->to_parent = NULL;
+    root->len = root->steps = 0;
+    global->diameter = 1;
+    for (unsigned int i = 0; i < graph->size; i++) {
+        struct node *node = graph->nodes[i];
+        for (struct edge *edge = node->fwd; edge != NULL; edge = edge->fwdnext) {
+            struct node *next = edge->dst;
+            if (next->id == 0 && next != root) {
+                next->to_parent = edge;
+                next->len = node->len + 1;
+                next->steps = node->steps + edge->nsteps;
+                graph_add(graph, next);
+                if (next->len >= global->diameter) {
+                    global->diameter = next->len + 1;
+                }
+            }
+        }
+    }
+}
+
+// Swarm mode: one of many small, diversified searches.  It is a depth-
+// first search from the initial state with its own bitstate table, its own
+// random order of expanding contexts and choices (see do_work1()), and its
+// own depth bound, between half and all of global->swarm_depth.  It ends
+// when it runs out of states or reaches global->swarm_states states.
+// If it finds a failure, it stops all searches and keeps its states for
+// the counterexample.  Otherwise it releases them.
+static void swarm_search(struct worker *w, struct node *root, unsigned int search){
+    struct global *global = w->global;
+    w->rand = hash_mum(search + 1, HASH_P1) | 1;
+    unsigned int depth = global->swarm_depth / 2 +
+                    swarm_random(w) % (global->swarm_depth / 2 + 1);
+    bitstate_clear(w->bitstate);
+    bitstate_insert(w->bitstate, state_hash(root->state));
+
+    struct node *all = NULL;        // states allocated by this search
+    unsigned int sp = 0, nstates = 1;
+    w->dfs[sp++] = root;
+    while (sp > 0 && nstates < global->swarm_states &&
+                                    !atomic_load(&global->stop)) {
+        struct node *node = w->dfs[--sp];
+        if (node->failed || node->len >= depth) {
+            continue;
+        }
+        w->dequeued++;
+        w->progress = false;
+        do_work1(w, node, 0);
+        if (!w->progress && !node->failed) {
+            bitstate_stuck(w, node);
+        }
+
+        // Push the new states.  do_work1() produced them in random order.
+        struct node *next;
+        while ((next = w->results) != NULL) {
+            w->results = next->next;
+            next->next = all;
+            all = next;
+            if (sp == w->dfs_alloc) {
+                w->dfs_alloc *= 2;
+                w->dfs = realloc(w->dfs, w->dfs_alloc * sizeof(*w->dfs));
+            }
+            w->dfs[sp++] = next;
+            nstates++;
+        }
+        w->count = 0;
+
+        if (w->failures != NULL || w->stuck != NULL) {
+            atomic_store(&global->stop, true);
+            return;
+        }
+    }
+    w->searches++;
+
+    struct node *next;
+    while ((next = all) != NULL) {
+        all = next->next;
+        free(next);
+    }
+}
+
+static void swarm_worker(void *arg){
+    struct worker *w = arg;
+    struct global *global = w->global;
+    struct node *root = global->graph.nodes[0];
+
+    w->dfs_alloc = 1024;
+    w->dfs = malloc(w->dfs_alloc * sizeof(*w->dfs));
+    while (!atomic_load(&global->stop)) {
+        unsigned int search = atomic_fetch_add(&global->swarm_next, 1);
+        if (search >= global->swarm) {
+            break;
+        }
+        swarm_search(w, root, search);
+    }
+
+    // Wait for the other workers to finish
+    barrier_wait(w->end_barrier);
+}
+
+// Random-walk mode: a single random execution of up to global->walk_depth
+// steps from the initial state.  In each state it tries the choices or
+// the contexts in random order until one of them changes the state, and
+// then picks one of the resulting states.  If none can change the state,
+// the walk is stuck and ends, and bitstate_stuck() checks it.  Nothing is
+// remembered between walks.  As in swarm mode, a failure stops all walks
+// and the states of the failing walk are kept for the counterexample.
+static void walk(struct worker *w, struct node *root, unsigned int n){
+    struct global *global = w->global;
+    w->rand = hash_mum(global->walk_seed + n + 1, HASH_P2) | 1;
+
+    struct node *all = NULL;        // states allocated by this walk
+    struct node *node = root;
+    for (unsigned int len = 0; len < global->walk_depth; len++) {
+        struct state *state = node->state;
+        w->dequeued++;
+        if (state->choosing != 0) {
+            struct context *cc = value_get(state->choosing, NULL);
+            hvalue_t s = ctx_stack(cc)[cc->sp - 1];
+            assert(VALUE_TYPE(s) == VALUE_SET);
+            unsigned int size;
+            hvalue_t *vals = value_get(s, &size);
+            size /= sizeof(hvalue_t);
+            unsigned int start = swarm_random(w) % size;
+            for (unsigned int i = 0; i < size && w->results == NULL; i++) {
+                make_step(w, node, state->choosing, vals[(start + i) % size],
+                                                        1, &w->results);
+            }
+        }
+        else {
+            unsigned int order[MAX_CONTEXT_BAG];
+            for (unsigned int i = 0; i < state->bagsize; i++) {
+                order[i] = i;
+            }
+            for (unsigned int k = 0; k < state->bagsize && w->results == NULL; k++) {
+                unsigned int j = k + swarm_random(w) % (state->bagsize - k);
+                unsigned int i = order[j];
+                order[j] = order[k];
+                make_step(w, node, state_contexts(state)[i], 0,
+                            multiplicities(state)[i], &w->results);
+            }
+        }
+
+        // Pick one of the resulting states and keep track of all of them
+        struct node *next = NULL, *r;
+        unsigned int pick = w->count == 0 ? 0 : swarm_random(w) % w->count;
+        for (unsigned int i = 0; (r = w->results) != NULL; i++) {
+            w->results = r->next;
+            r->next = all;
+            all = r;
+            if (i == pick) {
+                next = r;
+            }
+        }
+        w->count = 0;
+
+        if (next == NULL) {
+            bitstate_stuck(w, node);
+        }
+        if (w->failures != NULL || w->stuck != NULL) {
+            atomic_store(&global->stop, true);
+            return;
+        }
+        if (next == NULL) {
+            break;
+        }
+        node = next;
+    }
+    w->searches++;
+
+    struct node *next;
+    while ((next = all) != NULL) {
+        all = next->next;
+        free(next);
+    }
+}
+
+static void walk_worker(void *arg){
+    struct worker *w = arg;
+    struct global *global = w->global;
+    struct node *root = global->graph.nodes[0];
+
+    while (!atomic_load(&global->stop)) {
+        unsigned int n = atomic_fetch_add(&global->swarm_next, 1);
+        if (n >= global->walks) {
+            break;
+        }
+        walk(w, root, n);
+    }
+
+    // Wait for the other workers to finish
+    barrier_wait(w->end_barrier);
+}
+
+#define EXTMEM_CHUNK    (1 << 16)       // #states loaded at a time
+
+// On-the-fly mode (--on-the-fly): a depth-first search that finds the
+// strongly connected components with Tarjan's algorithm as it goes, rather
+// than in a separate pass once the graph is complete.  When the search
+// backs out of the first state of a component, the component is complete
+// and is classified as in the graph analysis: it is good if it has an
+// edge to another component, final if all its states have the same shared
+// variables and only eternal threads, and otherwise none of its states
+// terminate.  The search stops at the first failure.  It is sequential.
+struct tarjan_frame {
+    struct node *node;
+    struct edge *edge;          // next edge of node to follow
+};
+
+struct tarjan_failure {
+    struct node *node;
+    enum fail_type type;
+    hvalue_t address;
+};
+
+#define TARJAN_DONE     ((uint32_t) -1)
+
+struct tarjan {
+    // Indexed by node identifier
+    uint32_t *index;            // order of visit, 0 if not yet visited, or
+                                // TARJAN_DONE if its component is complete
+    uint32_t *low;              // lowest index of a state reachable
+    bool *exit;                 // has an edge to a complete component
+    unsigned int alloc;         // allocated size of the above
+    uint32_t count;             // #states visited
+
+    struct tarjan_frame *frames;    // depth-first search stack
+    unsigned int nframes, frames_alloc;
+    struct node **stack;        // states of incomplete components
+    unsigned int sp, stack_alloc;
+    unsigned int ncomponents;   // #components completed
+
+    struct tarjan_failure *failures;    // of the last complete component
+    unsigned int nfailures, failures_alloc;
+};
+
+static void tarjan_fail(struct tarjan *t, struct node *node, enum fail_type type, hvalue_t address){
+    if (t->nfailures == t->failures_alloc) {
+        t->failures_alloc = (t->failures_alloc + 1) * 2;
+        t->failures = realloc(t->failures, t->failures_alloc * sizeof(*t->failures));
+    }
+    struct tarjan_failure *tf = &t->failures[t->nfailures++];
+    tf->node = node;
+    tf->type = type;
+    tf->address = address;
+}
+
+// Expand a state that was not visited before.  Returns false if a failure
+// was found.
+static bool tarjan_visit(struct tarjan *t, struct worker *w, struct node *node){
+    struct global *global = w->global;
+    struct graph *graph = &global->graph;
+
+    t->count++;
+    t->index[node->id] = t->low[node->id] = t->count;
+    if (t->sp == t->stack_alloc) {
+        t->stack_alloc *= 2;
+        t->stack = realloc(t->stack, t->stack_alloc * sizeof(*t->stack));
+    }
+    t->stack[t->sp++] = node;
+
+    w->dequeued++;
+    do_work1(w, node, 0);
+
+    // Add the forward edges that could not be added right away
+    for (unsigned int i = 0; i < w->nworkers; i++) {
+        struct edge *e;
+        while ((e = w->edges[i]) != NULL) {
+            w->edges[i] = e->fwdnext;
+            e->fwdnext = e->src->fwd;
+            e->src->fwd = e;
+        }
+    }
+
+    // Add the new states to the graph
+    struct node *next;
+    while ((next = w->results) != NULL) {
+        w->results = next->next;
+        graph_add(graph, next);
+    }
+    w->count = 0;
+    if (graph->alloc_size > t->alloc) {
+        t->index = realloc(t->index, graph->alloc_size * sizeof(*t->index));
+        t->low = realloc(t->low, graph->alloc_size * sizeof(*t->low));
+        t->exit = realloc(t->exit, graph->alloc_size * sizeof(*t->exit));
+        memset(&t->index[t->alloc], 0, (graph->alloc_size - t->alloc) * sizeof(*t->index));
+        memset(&t->exit[t->alloc], 0, (graph->alloc_size - t->alloc) * sizeof(*t->exit));
+        t->alloc = graph->alloc_size;
+    }
+
+    if (t->nframes == t->frames_alloc) {
+        t->frames_alloc *= 2;
+        t->frames = realloc(t->frames, t->frames_alloc * sizeof(*t->frames));
+    }
+    t->frames[t->nframes].node = node;
+    t->frames[t->nframes].edge = node->fwd;
+    t->nframes++;
+    return w->failures == NULL;
+}
+
+// The component of which node is the first visited state is complete.
+// Returns false if the component has a failure.
+static bool tarjan_component(struct tarjan *t, struct worker *w, struct node *node){
+    struct global *global = w->global;
+    unsigned int first = t->sp;
+    do {
+        assert(first > 0);
+        first--;
+    } while (t->stack[first] != node);
+
+    bool good = false, all_same = true;
+    for (unsigned int i = first; i < t->sp; i++) {
+        struct node *n = t->stack[i];
+        if (t->exit[n->id]) {
+            good = true;
+        }
+        if (n->state->vars != node->state->vars ||
+                    !value_state_all_eternal(n->state) ||
+                    !value_ctx_all_eternal(n->state->stopbag)) {
+            all_same = false;
+        }
+        t->index[n->id] = TARJAN_DONE;
+        n->component = t->ncomponents;
+    }
+    t->ncomponents++;
+
+    if (!good) {
+        for (unsigned int i = first; i < t->sp; i++) {
+            struct node *n = t->stack[i];
+            if (!all_same) {
+                tarjan_fail(t, n, FAIL_TERMINATION, 0);
+                continue;
+            }
+
+            // Only eternal threads are left, so check the final state
+            n->final = true;
+            if (global->dfa != NULL &&
+                        !dfa_is_final(global->dfa, n->state->dfa_state)) {
+                tarjan_fail(t, n, FAIL_BEHAVIOR, 0);
+            }
+            unsigned int fin = check_finals(global, n, &w->inv_step);
+            if (fin != 0) {
+                tarjan_fail(t, n, FAIL_FINALLY, VALUE_TO_PC(fin));
+            }
+        }
+    }
+    t->sp = first;
+    return t->nfailures == 0;
+}
+
+static void tarjan_search(struct worker *w, struct node *root){
+    struct global *global = w->global;
+    struct graph *graph = &global->graph;
+    struct tarjan t;
+    memset(&t, 0, sizeof(t));
+    t.alloc = graph->alloc_size;
+    t.index = calloc(t.alloc, sizeof(*t.index));
+    t.low = malloc(t.alloc * sizeof(*t.low));
+    t.exit = calloc(t.alloc, sizeof(*t.exit));
+    t.frames_alloc = t.stack_alloc = 1024;
+    t.frames = malloc(t.frames_alloc * sizeof(*t.frames));
+    t.stack = malloc(t.stack_alloc * sizeof(*t.stack));
+
+    bool ok = tarjan_visit(&t, w, root);
+    while (ok && t.nframes > 0) {
+        struct tarjan_frame *frame = &t.frames[t.nframes - 1];
+        struct node *node = frame->node;
+        struct edge *edge = frame->edge;
+
+        // Follow the next edge
+        if (edge != NULL) {
+            frame->edge = edge->fwdnext;
+            struct node *next = edge->dst;
+            if (next == node) {
+                continue;
+            }
+            uint32_t index = t.index[next->id];
+            if (index == 0) {
+                ok = tarjan_visit(&t, w, next);
+            }
+            else if (index == TARJAN_DONE) {
+                t.exit[node->id] = true;
+            }
+            else if (index < t.low[node->id]) {
+                t.low[node->id] = index;
+            }
+            continue;
+        }
+
+        // All edges followed: back out
+        t.nframes--;
+        if (t.low[node->id] == t.index[node->id]) {
+            ok = tarjan_component(&t, w, node);
+        }
+        if (t.nframes > 0) {
+            struct node *parent = t.frames[t.nframes - 1].node;
+            if (t.index[node->id] == TARJAN_DONE) {
+                t.exit[parent->id] = true;
+            }
+            else if (t.low[node->id] < t.low[parent->id]) {
+                t.low[parent->id] = t.low[node->id];
+            }
+        }
+    }
+    global->ncomponents = t.ncomponents;
+
+    // The paths found by a depth-first search are long.  Renumber the
+    // states in breadth-first order for shortest paths.
+    for (unsigned int i = 0; i < graph->size; i++) {
+        graph->nodes[i]->id = 0;
+    }
+    async_bfs(global, root);
+
+    // Failures of complete components are reported like deadlocks in
+    // bitstate mode, that is, only if there are no other failures
+    for (unsigned int i = 0; i < t.nfailures; i++) {
+        struct tarjan_failure *tf = &t.failures[i];
+        struct failure *f = new_alloc(struct failure);
+        f->type = tf->type;
+        f->address = tf->address;
+        if (tf->type == FAIL_TERMINATION && tf->node->fwd != NULL &&
+                                    tf->node->fwd->fwdnext == NULL) {
+            f->edge = tf->node->fwd;
+        }
+        else {
+            f->edge = tf->node->to_parent;
+        }
+        f->next = w->stuck;
+        w->stuck = f;
+    }
+
+    free(t.index);
+    free(t.low);
+    free(t.exit);
+    free(t.frames);
+    free(t.stack);
+    free(t.failures);
+}
+
+// External-memory mode: load the next chunk of states to expand.  Called
+// by worker 0 between rounds.  Returns false if the search is over, either
+// because a failure was found or because there are no more states.  In
+// the first case the chunk is kept, as the failures refer to it.
+static bool extmem_prepare(struct worker *w){
+    struct global *global = w->global;
+    struct extmem *em = global->extmem;
+    for (unsigned int i = 0; i < w->nworkers; i++) {
+        if (w->workers[i].failures != NULL) {
+            return false;
+        }
+    }
+    while (extmem_load(em, EXTMEM_CHUNK) == 0) {
+        uint32_t nstates = em->nstates;
+        if (!extmem_next_layer(em)) {
+            return false;
+        }
+        w->enqueued += em->nstates - nstates;
+        if (em->layer >= global->diameter) {
+            global->diameter = em->layer + 1;
+        }
+    }
+    atomic_store(&global->swarm_next, 0);
+    return true;
+}
+
+// External-memory mode: the states are read from disk a chunk at a time
+// and expanded by all workers.  The successors go back to disk (see
+// bitstate_edge()), and at the end of each layer worker 0 removes the
+// duplicates (see extmem_next_layer()).  The search stops at the end of
+// a chunk in which a failure was found.
+static void extmem_worker(void *arg){
+    struct worker *w = arg;
+    struct global *global = w->global;
+    struct extmem *em = global->extmem;
+
+    for (;;) {
+        if (w->index == 0 && !extmem_prepare(w)) {
+            atomic_store(&global->stop, true);
+        }
+        barrier_wait(w->start_barrier);
+        if (atomic_load(&global->stop)) {
+            break;
+        }
+        unsigned int i;
+        while ((i = atomic_fetch_add(&global->swarm_next, 1)) < em->chunk_size) {
+            w->dequeued++;
+            do_work1(w, em->chunk[i], 0);
+
+            // Only failing states are kept, and the failures refer to them
+            w->results = NULL;
+            w->count = 0;
+        }
+        barrier_wait(w->middle_barrier);
+    }
+}
+
+#endif // USE_ATOMIC
+
+// External-memory mode: the analysis of components that main() does on
+// the graph, but on the logged edges.  It reads the stored states twice.
+// A component without a way out is final if all its states have the same
+// shared variables and only eternal threads.  The finally clauses and the
+// behavior are checked in final components, and the other components
+// without a way out are non-terminating.  States are in breadth-first
+// order, so the first failing state found has a shortest path.
+static void extmem_analyze(struct global *global, struct step *step){
+    struct extmem *em = global->extmem;
+    uint32_t ncomponents, id;
+    bool *good;
+    uint32_t *comp = extmem_components(em, &ncomponents, &good);
+    printf("    * %u components\n", ncomponents);
+
+    hvalue_t *vars = malloc(ncomponents * sizeof(*vars));
+    bool *seen = calloc(ncomponents, sizeof(*seen));
+    bool *final = calloc(ncomponents, sizeof(*final));
+    struct state *state;
+    extmem_rewind(em);
+    while ((state = extmem_scan(em, &id)) != NULL) {
+        uint32_t c = comp[id];
+        bool eternal = value_state_all_eternal(state) &&
+                            value_ctx_all_eternal(state->stopbag);
+        if (!seen[c]) {
+            seen[c] = true;
+            vars[c] = state->vars;
+            final[c] = !good[c] && eternal;
+        }
+        else if (state->vars != vars[c] || !eternal) {
+            final[c] = false;
+        }
+    }
+
+    struct failure *f = NULL;
+    uint32_t bad = EXTMEM_NONE;
+    extmem_rewind(em);
+    while (f == NULL && (state = extmem_scan(em, &id)) != NULL) {
+        uint32_t c = comp[id];
+        if (good[c]) {
+            continue;
+        }
+        if (!final[c]) {
+            if (bad == EXTMEM_NONE) {
+                bad = id;
             }
-            global->scc_nwaiting--;
+            continue;
+        }
+        if (global->dfa != NULL && !dfa_is_final(global->dfa, state->dfa_state)) {
+            f = new_alloc(struct failure);
+            f->type = FAIL_BEHAVIOR;
+            break;
+        }
+        struct node tmp;
+        memset(&tmp, 0, sizeof(tmp));
+        tmp.state = state;
+        unsigned int fin = check_finals(global, &tmp, step);
+        if (fin != 0) {
+            f = new_alloc(struct failure);
+            f->type = FAIL_FINALLY;
+            f->address = VALUE_TO_PC(fin);
         }
+    }
+    if (f == NULL && bad != EXTMEM_NONE) {
+        f = new_alloc(struct failure);
+        f->type = FAIL_TERMINATION;
+        id = bad;
+    }
+    if (f != NULL) {
+        struct node *node = extmem_path(em, id, global->graph.nodes[0]);
+        f->edge = node->to_parent;
+        minheap_insert(global->failures, f);
+    }
 
-        // Grab work
-        unsigned int component = global->ncomponents++;
-        struct scc *scc = global->scc_todo;
-        assert(scc != NULL);
-        global->scc_todo = scc->next;
-        scc->next = NULL;
+    free(comp);
+    free(good);
+    free(vars);
+    free(seen);
+    free(final);
+}
 
-        // Split binary semaphore release
-        if (global->scc_todo != NULL && global->scc_nwaiting > 0) {
-            mutex_release(&global->todo_wait);
+static void scc_worker(void *arg){
+    struct scc_worker *w = arg;
+    struct global *global = w->global;
+    struct scc_pool *pool = w->pool;
+
+    // Phase 1: remove the states that are components by themselves
+    if (pool->trim) {
+        scc_trim_init(pool, w->index);
+        barrier_wait(w->scc_barrier);
+        scc_trim(pool, w->index);
+        barrier_wait(w->scc_barrier);
+        scc_trim_count(pool, w->index);
+        barrier_wait(w->scc_barrier);
+        scc_trim_compact(pool, w->index);
+        barrier_wait(w->scc_barrier);
+    }
+    if (w->index == 0) {
+        if (pool->trim) {
+            scc_trim_done(pool);
         }
-        else {
-            mutex_release(&global->todo_enter);
+        pool->trimmed_at = gettime();
+        if (pool->ntrimmed < pool->nnodes) {
+            scc_pool_put(pool, &w->slots, 0, pool->nnodes - pool->ntrimmed);
         }
+    }
+    barrier_wait(w->scc_barrier);
 
-        for (;;) {
-            // Do the work
+    // Phase 2: partition the remaining states
+    unsigned int start, finish;
+    while (scc_pool_get(pool, &w->slots, &start, &finish)) {
+        struct scc *scc = scc_alloc(start, finish, NULL, &w->scc_cache);
+        do {
+            unsigned int component = scc_pool_component(pool);
             assert(scc->next == NULL);
             scc = graph_find_scc_one(&global->graph, scc, component, &w->scc_cache);
 
-            // Put new work on the list except the last (which we'll do ourselves)
-            mutex_acquire(&global->todo_enter);
+            // Put new work in the pool except the last (which we'll do ourselves)
             while (scc != NULL && scc->next != NULL) {
                 struct scc *next = scc->next;
-                scc->next = global->scc_todo;
-                global->scc_todo = scc;
+                scc_pool_put(pool, &w->slots, scc->start, scc->finish);
+                * (void **) scc = w->scc_cache;
+                w->scc_cache = scc;
                 scc = next;
             }
-            if (scc == NULL) {      // get more work
-                break;
-            }
-            component = global->ncomponents++;
-
-            // Split binary semaphore release
-            if (global->scc_todo != NULL && global->scc_nwaiting > 0) {
-                mutex_release(&global->todo_wait);
-            }
-            else {
-                mutex_release(&global->todo_enter);
-            }
-        }
+        } while (scc != NULL);
+        scc_pool_done(pool);
     }
     barrier_wait(w->scc_barrier);
 }
@@ -2513,12 +4194,24 @@ static void inthandler(int sig){
 #endif
 
 static void usage(char *prog){
-    fprintf(stderr, "Usage: %s [-c] [-t<maxtime>] [-B<dfafile>] -o<outfile> file.json\n", prog);
+    fprintf(stderr, "Usage: %s [-a] [-b[<MB>[,<k>]]] [-c] [-C<file>[,<seconds>]] [-G<factor>[,<load>]] [-H{chain,open,hashtab}] [-p] [-s] [-t<maxtime>] [-e<dir>[,<partitions>]] [-r<walks>[,<depth>[,<seed>]]] [-W<searches>[,<states>[,<depth>]]] [-B<dfafile>] [--csr] [--first-failure] [--max-memory=<MB>] [--on-the-fly] -o<outfile> file.json\n", prog);
     exit(1);
 }
 
 int main(int argc, char **argv){
-    bool cflag = false, dflag = false, Dflag = false, Rflag = false;
+    bool aflag = false, cflag = false, dflag = false, Dflag = false, Rflag = false;
+    bool open_dicts = false, ht_dicts = false, pflag = false, sflag = false;
+    bool first_failure = false, csr = false, onthefly = false;
+    unsigned int max_memory = 0;
+    unsigned int growth_factor = 10;
+    unsigned int bitstate_mb = 0, bitstate_k = 3;
+    unsigned int swarm = 0, swarm_states = 100000, swarm_depth = 1000;
+    unsigned int walks = 0, walk_depth = 1000, walk_seed = 0;
+    char *extmem_dir = NULL;
+    unsigned int extmem_partitions = 64;
+    char *cpfile = NULL;
+    double cp_interval = 300;
+    double growth_threshold = 2;
     int i, maxtime = 300000000 /* about 10 years */;
     char *outfile = NULL, *dfafile = NULL;
     unsigned int nworkers = 0;
@@ -2527,18 +4220,75 @@ int main(int argc, char **argv){
             break;
         }
         switch (argv[i][1]) {
+        case 'a':               // async mode (no rounds)
+            aflag = true;
+            break;
+        case 'b':               // bitstate hashing
+            bitstate_mb = 64;
+            if (argv[i][2] != 0 && (sscanf(&argv[i][2], "%u,%u", &bitstate_mb, &bitstate_k) < 1 ||
+                                bitstate_mb == 0 || bitstate_k == 0 || bitstate_k > 16)) {
+                usage(argv[0]);
+            }
+            break;
         case 'c':
             cflag = true;
             break;
+        case 'C':               // checkpoint and resume
+            {
+                cpfile = &argv[i][2];
+                char *comma = strrchr(cpfile, ',');
+                if (comma != NULL && sscanf(comma + 1, "%lf", &cp_interval) == 1) {
+                    *comma = 0;
+                }
+                if (*cpfile == 0 || cp_interval < 0) {
+                    usage(argv[0]);
+                }
+            }
+            break;
         case 'd':               // run direct (no model check)
             dflag = true;
             break;
+        case 'e':               // external-memory mode
+            {
+                extmem_dir = &argv[i][2];
+                char *comma = strrchr(extmem_dir, ',');
+                if (comma != NULL && sscanf(comma + 1, "%u", &extmem_partitions) == 1) {
+                    *comma = 0;
+                }
+                if (*extmem_dir == 0 || extmem_partitions == 0) {
+                    usage(argv[0]);
+                }
+            }
+            break;
         case 'D':
             Dflag = true;
             break;
+        case 'G':               // hash table growth policy
+            if (sscanf(&argv[i][2], "%u,%lf", &growth_factor, &growth_threshold) < 1 ||
+                                growth_factor < 2 || growth_threshold <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'H':               // hash table implementation
+            if (strcmp(&argv[i][2], "open") == 0) {
+                open_dicts = true;
+            }
+            else if (strcmp(&argv[i][2], "hashtab") == 0) {
+                ht_dicts = true;
+            }
+            else if (strcmp(&argv[i][2], "chain") != 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'p':               // partial-order reduction
+            pflag = true;
+            break;
         case 'R':
             Rflag = true;
             break;
+        case 's':               // hash table statistics
+            sflag = true;
+            break;
         case 't':
             maxtime = atoi(&argv[i][2]);
             if (maxtime <= 0) {
@@ -2555,9 +4305,40 @@ int main(int argc, char **argv){
         case 'w':
             nworkers = atoi(&argv[i][2]);
             break;
+        case 'r':               // random-walk mode
+            if (sscanf(&argv[i][2], "%u,%u,%u", &walks, &walk_depth, &walk_seed) < 1 ||
+                    walks == 0 || walk_depth == 0 || walk_depth > 65535) {
+                usage(argv[0]);
+            }
+            break;
+        case 'W':               // swarm mode
+            if (sscanf(&argv[i][2], "%u,%u,%u", &swarm, &swarm_states, &swarm_depth) < 1 ||
+                    swarm == 0 || swarm_states == 0 || swarm_depth < 2 || swarm_depth > 65535) {
+                usage(argv[0]);
+            }
+            break;
         case 'x':
             printf("Charm model checker working\n");
             return 0;
+        case '-':
+            if (strcmp(argv[i], "--csr") == 0) {
+                csr = true;
+            }
+            else if (strcmp(argv[i], "--first-failure") == 0) {
+                first_failure = true;
+            }
+            else if (strcmp(argv[i], "--on-the-fly") == 0) {
+                onthefly = true;
+            }
+            else if (strncmp(argv[i], "--max-memory=", 13) == 0) {
+                if (sscanf(&argv[i][13], "%u", &max_memory) != 1 || max_memory == 0) {
+                    usage(argv[0]);
+                }
+            }
+            else {
+                usage(argv[0]);
+            }
+            break;
         default:
             usage(argv[0]);
         }
@@ -2565,6 +4346,73 @@ int main(int argc, char **argv){
     if (argc - i != 1) {
         usage(argv[0]);
     }
+#ifndef USE_ATOMIC
+    if (aflag) {
+        fprintf(stderr, "%s: -a not supported on this platform\n", argv[0]);
+        exit(1);
+    }
+    if (open_dicts) {
+        fprintf(stderr, "%s: -Hopen not supported on this platform\n", argv[0]);
+        exit(1);
+    }
+    if (ht_dicts) {
+        fprintf(stderr, "%s: -Hhashtab not supported on this platform\n", argv[0]);
+        exit(1);
+    }
+    if (swarm != 0) {
+        fprintf(stderr, "%s: -W not supported on this platform\n", argv[0]);
+        exit(1);
+    }
+    if (walks != 0) {
+        fprintf(stderr, "%s: -r not supported on this platform\n", argv[0]);
+        exit(1);
+    }
+    if (extmem_dir != NULL) {
+        fprintf(stderr, "%s: -e not supported on this platform\n", argv[0]);
+        exit(1);
+    }
+    if (first_failure) {
+        fprintf(stderr, "%s: --first-failure not supported on this platform\n", argv[0]);
+        exit(1);
+    }
+    if (onthefly) {
+        fprintf(stderr, "%s: --on-the-fly not supported on this platform\n", argv[0]);
+        exit(1);
+    }
+#endif
+    if (aflag && ht_dicts) {
+        fprintf(stderr, "%s: -Hhashtab cannot be combined with -a\n", argv[0]);
+        exit(1);
+    }
+    if (aflag && bitstate_mb != 0) {
+        fprintf(stderr, "%s: -b cannot be combined with -a\n", argv[0]);
+        exit(1);
+    }
+    if (swarm != 0 && (aflag || bitstate_mb != 0)) {
+        fprintf(stderr, "%s: -W cannot be combined with -a or -b\n", argv[0]);
+        exit(1);
+    }
+    if (walks != 0 && (aflag || bitstate_mb != 0 || swarm != 0)) {
+        fprintf(stderr, "%s: -r cannot be combined with -a, -b, or -W\n", argv[0]);
+        exit(1);
+    }
+    if (extmem_dir != NULL && (aflag || bitstate_mb != 0 || pflag || walks != 0 || swarm != 0)) {
+        fprintf(stderr, "%s: -e cannot be combined with -a, -b, -p, -r, or -W\n", argv[0]);
+        exit(1);
+    }
+    if (cpfile != NULL && (aflag || bitstate_mb != 0 || extmem_dir != NULL || walks != 0 || swarm != 0)) {
+        fprintf(stderr, "%s: -C cannot be combined with -a, -b, -e, -r, or -W\n", argv[0]);
+        exit(1);
+    }
+    if (max_memory != 0 && (aflag || extmem_dir != NULL || walks != 0 || swarm != 0)) {
+        fprintf(stderr, "%s: --max-memory cannot be combined with -a, -e, -r, or -W\n", argv[0]);
+        exit(1);
+    }
+    if (onthefly && (aflag || bitstate_mb != 0 || cpfile != NULL || extmem_dir != NULL ||
+                        pflag || walks != 0 || swarm != 0 || max_memory != 0)) {
+        fprintf(stderr, "%s: --on-the-fly cannot be combined with -a, -b, -C, -e, -p, -r, -W, or --max-memory\n", argv[0]);
+        exit(1);
+    }
     char *fname = argv[i];
     double timeout = gettime() + maxtime;
 
@@ -2590,16 +4438,16 @@ int main(int argc, char **argv){
 
     // initialize modules
     mutex_init(&global->inv_lock);
-#ifdef USE_ATOMIC
-    atomic_init(&global->atodo, 0);
-#else
-    mutex_init(&global->todo_lock);
-#endif
-    global->goal = 1;
-    mutex_init(&global->todo_enter);
-    mutex_init(&global->todo_wait);
-    mutex_acquire(&global->todo_wait);          // Split Binary Semaphore
-    global->values = dict_new("values", 0, 0, global->nworkers, true);
+    global->values = values_new(global->nworkers);
+    for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+        dict_set_growth(global->values[i], growth_factor, growth_threshold);
+        if (open_dicts) {
+            dict_set_open(global->values[i]);
+        }
+        else if (ht_dicts) {
+            dict_set_hashtab(global->values[i]);
+        }
+    }
 
     struct engine engine;
     engine.allocator = NULL;
@@ -2638,6 +4486,7 @@ int main(int argc, char **argv){
 
     // parse the contents
 	char *buf_orig = buf.base;
+    uint64_t fingerprint = hash64(buf.base, buf.len);
     struct json_value *jv = json_parse_value(&buf);
     assert(jv->type == JV_MAP);
 	free(buf_orig);
@@ -2646,6 +4495,36 @@ int main(int argc, char **argv){
     struct json_value *jc = dict_lookup(jv->u.map, "code", 4);
     assert(jc->type == JV_LIST);
     global->code = code_init_parse(&engine, jc);
+    ops_predicates_alloc(global);
+    if (pflag && ops_inspects_contexts(global)) {
+        fprintf(stderr, "%s: warning: countLabel() is used, so -p is ignored\n", argv[0]);
+        pflag = false;
+    }
+    global->por = pflag;
+    global->first_failure = first_failure;
+    global->onthefly = onthefly;
+    global->max_memory = (uint64_t) max_memory << 20;
+    if (bitstate_mb != 0) {
+        global->bitstate = bitstate_new((uint64_t) bitstate_mb << 23, bitstate_k);
+    }
+    global->swarm = swarm;
+    global->swarm_states = swarm_states;
+    global->swarm_depth = swarm_depth;
+    global->walks = walks;
+    global->walk_depth = walk_depth;
+    global->walk_seed = walk_seed;
+    if (extmem_dir != NULL) {
+        global->extmem = extmem_new(extmem_dir, extmem_partitions);
+        if (global->extmem == NULL) {
+            fprintf(stderr, "%s: can't create files in %s\n", argv[0], extmem_dir);
+            exit(1);
+        }
+    }
+    if (cpfile != NULL) {
+        // A checkpoint is only good for the same model and reductions
+        fingerprint ^= hash_mum(pflag | ((dfafile != NULL) << 1), HASH_P1);
+        global->checkpoint = checkpoint_new(cpfile, cp_interval, fingerprint);
+    }
 
     // Create an initial state
     struct context *init_ctx = calloc(1, sizeof(struct context) + MAX_CONTEXT_STACK * sizeof(hvalue_t));
@@ -2658,9 +4537,7 @@ int main(int argc, char **argv){
     struct state *state = calloc(1, sizeof(struct state) + sizeof(hvalue_t) + 1);
     state->vars = VALUE_DICT;
     hvalue_t ictx = value_put_context(&engine, init_ctx);
-    state->bagsize = 1;
-    state_contexts(state)[0] = ictx;
-    multiplicities(state)[0] = 1;
+    context_add(state, ictx);
     state->stopbag = VALUE_DICT;
     state->dfa_state = global->dfa == NULL ? 0 : dfa_initial(global->dfa);
 
@@ -2699,6 +4576,13 @@ int main(int argc, char **argv){
 
     // Create the hash table that maps states to nodes
     struct dict *visited = dict_new("visited", sizeof(struct node), 0, global->nworkers, false);
+    dict_set_growth(visited, growth_factor, growth_threshold);
+    if (open_dicts) {
+        dict_set_open(visited);
+    }
+    else if (ht_dicts) {
+        dict_set_hashtab(visited);
+    }
 
     // Allocate space for worker info
     struct worker *workers = calloc(global->nworkers, sizeof(*workers));
@@ -2714,7 +4598,28 @@ int main(int argc, char **argv){
         w->workers = workers;
         w->nworkers = global->nworkers;
         w->edges = calloc(global->nworkers, sizeof(struct edge *));
+#ifdef USE_ATOMIC
+        atomic_init(&w->frontier, 0);
+#else
+        mutex_init(&w->frontier_lock);
+#endif
+        mutex_init(&w->queue_lock);
+        w->quota = ROUND_SIZE / global->nworkers;
+        if (w->quota < MIN_QUOTA) {
+            w->quota = MIN_QUOTA;
+        }
+        w->victim = i;
         w->profile = calloc(global->code.len, sizeof(*w->profile));
+        if (global->swarm != 0) {
+            // Enough bits for a hash factor of 32 with k = 3
+            w->bitstate = bitstate_new((uint64_t) global->swarm_states * 32, 3);
+        }
+        else {
+            w->bitstate = global->bitstate;
+        }
+        if (w->bitstate != NULL || global->walks != 0 || global->extmem != NULL) {
+            w->scratch_edge = malloc(sizeof(struct edge) + MAX_PRINT * sizeof(hvalue_t));
+        }
 
         // Create a context for evaluating invariants
         w->inv_step.ctx = calloc(1, sizeof(struct context) +
@@ -2742,36 +4647,145 @@ int main(int argc, char **argv){
     for (unsigned int i = 0; i < global->nworkers; i++) {
         struct scc_worker *w = &scc_workers[i];
         w->global = global;
+        w->index = i;
         w->scc_barrier = &scc_barrier;
+        w->failures_last = &w->failures;
+        w->step = &workers[i].inv_step;
     }
 
-    // Put the state and value dictionaries in concurrent mode
-    dict_set_concurrent(global->values);
-    dict_set_concurrent(visited);
+    // Put the state and value dictionaries in concurrent mode.  Swarm,
+    // random-walk, and external-memory mode do not make the dictionaries
+    // stable between rounds, so they need the value dictionaries to be
+    // async as well.
+    global->async = aflag;
+    for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+        if (global->async || global->swarm != 0 || global->walks != 0 ||
+                                global->extmem != NULL || global->onthefly) {
+            dict_set_async(global->values[i]);
+        }
+        else {
+            dict_set_concurrent(global->values[i]);
+        }
+    }
+    if (global->async || global->onthefly) {
+        dict_set_async(visited);
+    }
+    else {
+        dict_set_concurrent(visited);
+    }
+
+    // Resume from a checkpoint if there is one, or else put the initial
+    // state in the visited map
+    unsigned int layer_start;
+    struct node *node;
+    if (global->checkpoint != NULL && checkpoint_load(global->checkpoint,
+                global, visited, &workers[0].allocator, &layer_start)) {
+        for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+            dict_grow_prepare(global->values[i]);
+            for (unsigned int j = 0; j < global->nworkers; j++) {
+                dict_make_stable(global->values[i], j);
+            }
+        }
+        dict_grow_prepare(visited);
+        for (unsigned int j = 0; j < global->nworkers; j++) {
+            dict_make_stable(visited, j);
+        }
 
-    // Put the initial state in the visited map
-    mutex_t *lock;
-    struct dict_assoc *hn = dict_find_lock(visited, &workers[0].allocator, state, state_size(state), NULL, &lock);
-    struct node *node = (struct node *) &hn[1];
-    memset(node, 0, sizeof(*node));
-    node->state = (struct state *) &node[1];
-    node->lock = lock;
-    mutex_release(lock);
-    graph_add(&global->graph, node);
+        // Split the last layer among the workers
+        unsigned int nleft = global->graph.size - layer_start;
+        for (unsigned int i = 0; i < global->nworkers; i++) {
+            frontier_set(&workers[i],
+                layer_start + (uint64_t) nleft * i / global->nworkers,
+                layer_start + (uint64_t) nleft * (i + 1) / global->nworkers);
+        }
+        workers[0].enqueued = global->graph.size - 1;
+        workers[0].dequeued = layer_start;
+        node = global->graph.nodes[0];
+        printf("    * resuming from %s: %u states, %u to go\n",
+                    global->checkpoint->file, global->graph.size, nleft);
+    }
+    else {
+        mutex_t *lock;
+        struct dict_assoc *hn = dict_find_lock_hashed(visited, &workers[0].allocator, state, state_size(state), state_hash(state), NULL, &lock);
+        node = (struct node *) &hn[1];
+        memset(node, 0, sizeof(*node));
+        node->state = (struct state *) &node[1];
+        node->lock = lock;
+        mutex_release(lock);
+        graph_add(&global->graph, node);
+        frontier_set(&workers[0], 0, 1);
+    }
 
     // Compute how much table space is allocated
     global->allocated = global->graph.size * sizeof(struct node *) +
-        dict_allocated(visited) + dict_allocated(global->values);
+        dict_allocated(visited) + values_allocated(global->values);
 
-    // Start all but one of the workers, who'll wait on the start barrier
-    for (unsigned int i = 1; i < global->nworkers; i++) {
-        thread_create(worker, &workers[i]);
+    double before = gettime();
+
+#ifdef USE_ATOMIC
+    if (global->swarm != 0 || global->walks != 0) {
+        void (*f)(void *) = global->swarm != 0 ? swarm_worker : walk_worker;
+        atomic_init(&global->swarm_next, 0);
+        for (unsigned int i = 1; i < global->nworkers; i++) {
+            thread_create(f, &workers[i]);
+        }
+        (*f)(&workers[0]);
+
+        for (unsigned int i = 0; i < global->nworkers; i++) {
+            process_results(global, &workers[i]);
+        }
+    }
+    else if (global->extmem != NULL) {
+        extmem_root(global->extmem, state);
+        for (unsigned int i = 1; i < global->nworkers; i++) {
+            thread_create(extmem_worker, &workers[i]);
+        }
+        extmem_worker(&workers[0]);
+
+        for (unsigned int i = 0; i < global->nworkers; i++) {
+            process_results(global, &workers[i]);
+        }
     }
+    else if (global->onthefly) {
+        tarjan_search(&workers[0], node);
+        process_results(global, &workers[0]);
+        global->allocated = global->graph.size * sizeof(struct node *) +
+            dict_allocated(visited) + values_allocated(global->values);
+    }
+    else if (global->async) {
+        // Give the initial state to the first worker and start them all
+        workers[0].results = node;
+        workers[0].count = 1;
+        queue_push_results(&workers[0]);
+        for (unsigned int i = 1; i < global->nworkers; i++) {
+            thread_create(async_worker, &workers[i]);
+        }
+        async_worker(&workers[0]);
 
-    double before = gettime();
+        // The failures are ordered by path length, so fix the paths first
+        async_bfs(global, node);
+        for (unsigned int i = 0; i < global->nworkers; i++) {
+            process_results(global, &workers[i]);
+        }
+        global->allocated = global->graph.size * sizeof(struct node *) +
+            dict_allocated(visited) + values_allocated(global->values);
+    }
+    else
+#endif
+    {
+        // Start all but one of the workers, who'll wait on the start barrier
+        for (unsigned int i = 1; i < global->nworkers; i++) {
+            thread_create(worker, &workers[i]);
+        }
 
-    // Run the last worker.
-    worker(&workers[0]);
+        // Run the last worker.
+        worker(&workers[0]);
+
+        // The search is complete, so the checkpoint is no longer needed
+        if (global->checkpoint != NULL) {
+            checkpoint_remove(global->checkpoint);
+        }
+    }
 
     // Compute how much memory was used, approximately
     unsigned long allocated = global->allocated;
@@ -2789,14 +4803,15 @@ int main(int argc, char **argv){
         start_wait += w->start_wait;
         middle_wait += w->middle_wait;
         end_wait += w->end_wait;
-        printf("W%u: %lf %lf %lf %lf %lf %lf %lf\n", i,
+        printf("W%u: %lf %lf %lf %lf %lf %lf %lf %u\n", i,
                 w->phase1,
                 w->phase2a,
                 w->phase2b,
                 w->phase3,
                 w->start_wait/w->start_count,
                 w->middle_wait/w->middle_count,
-                w->end_wait/w->end_count);
+                w->end_wait/w->end_count,
+                w->steals);
     }
 #endif // REPORT_WORKERS
 #ifdef notdef
@@ -2815,13 +4830,88 @@ int main(int argc, char **argv){
         end_wait / global->nworkers);
 #endif
 
-    printf("    * %d states (time %.2lfs, mem=%.3lfGB)\n", global->graph.size, gettime() - before, (double) allocated / (1L << 30));
+    printf("    * %d states (time %.2lfs, mem=%.3lfGB)\n",
+            global->extmem != NULL ? global->extmem->nstates : global->graph.size,
+            gettime() - before, (double) allocated / (1L << 30));
+    if (global->bitstate != NULL) {
+        struct bitstate *bs = global->bitstate;
+        printf("    * bitstate: %.1lf%% of %"PRIu64" bits set (k = %u), expected #missed states %.2g\n",
+            100 * bitstate_fill(bs), bs->mask + 1, bs->k,
+            bitstate_omission(bs, global->graph.size));
+    }
+    if (global->degraded != 0) {
+        printf("    * memory budget: switched to bitstate hashing after %u states\n",
+                global->degraded);
+    }
+    if (global->out_of_memory) {
+        printf("    * memory budget of %.3lfGB used up: search stopped with %u states not yet explored\n",
+                (double) global->max_memory / (1L << 30), global->unexplored);
+    }
+    if (global->swarm != 0) {
+        unsigned int searches = 0;
+        unsigned long states = 0;
+        for (unsigned int i = 0; i < global->nworkers; i++) {
+            searches += workers[i].searches;
+            states += workers[i].enqueued;
+        }
+        printf("    * swarm: %u of %u searches completed, %lu states\n",
+                searches, global->swarm, states);
+    }
+    if (global->walks != 0) {
+        unsigned int nwalks = 0, covered = 0;
+        unsigned long steps = 0;
+        for (unsigned int i = 0; i < global->nworkers; i++) {
+            nwalks += workers[i].searches;
+            steps += workers[i].dequeued;
+        }
+        for (unsigned int pc = 0; pc < global->code.len; pc++) {
+            for (unsigned int i = 0; i < global->nworkers; i++) {
+                if (workers[i].profile[pc] != 0) {
+                    covered++;
+                    break;
+                }
+            }
+        }
+        printf("    * random walk: %u of %u walks completed, %lu steps, %u of %u instructions covered\n",
+                nwalks, global->walks, steps, covered, global->code.len);
+    }
+    if (global->extmem != NULL) {
+        struct extmem *em = global->extmem;
+        printf("    * external memory: %u layers, %"PRIu64" edges, %.3lfGB in store\n",
+                em->layer + 1, em->nedges, (double) em->store_size / (1L << 30));
+    }
+    if (global->por) {
+        unsigned int reduced = 0;
+        for (unsigned int i = 0; i < global->nworkers; i++) {
+            reduced += workers[i].reduced;
+        }
+        printf("    * partial-order reduction: %u states partially expanded\n", reduced);
+    }
+    if (sflag) {
+        dict_dump(visited);
+        for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+            dict_dump(global->values[i]);
+        }
+#ifndef _WIN32
+        struct rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#ifdef __APPLE__
+            double peak = (double) ru.ru_maxrss / (1L << 30);   // bytes
+#else
+            double peak = (double) ru.ru_maxrss / (1L << 20);   // kilobytes
+#endif
+            printf("peak memory: %.3lfGB\n", peak);
+        }
+#endif
+    }
 
     if (outfile == NULL) {
         exit(0);
     }
 
-    dict_set_sequential(global->values);
+    for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+        dict_set_sequential(global->values[i]);
+    }
     dict_set_sequential(visited);
 
     printf("* Phase 3: analysis\n");
@@ -2862,14 +4952,57 @@ int main(int argc, char **argv){
     }
 #endif
 
-    if (minheap_empty(global->failures)) {
+    // In bitstate, swarm, and random-walk mode there are no edges other
+    // than those to the parent, so only the checks done during exploration
+    // apply
+    if (global->bitstate != NULL || global->swarm != 0 || global->walks != 0) {
+        printf("    * %s mode: no checks for livelock, busy waiting, or data races\n",
+                global->swarm != 0 ? "swarm" : global->walks != 0 ? "random-walk" : "bitstate");
+
+        // As in the graph analysis, failures of final states and deadlocks
+        // are only reported if there are no other failures
+        if (minheap_empty(global->failures)) {
+            for (unsigned int i = 0; i < global->nworkers; i++) {
+                for (struct failure *f = workers[i].stuck; f != NULL; f = f->next) {
+                    minheap_insert(global->failures, f);
+                }
+            }
+        }
+    }
+    else if (global->onthefly) {
+        printf("    * on-the-fly mode: %u components completed, no checks for busy waiting or data races\n",
+                global->ncomponents);
+        if (minheap_empty(global->failures)) {
+            for (struct failure *f = workers[0].stuck; f != NULL; f = f->next) {
+                minheap_insert(global->failures, f);
+            }
+        }
+    }
+    else if (global->extmem != NULL) {
+        printf("    * external-memory mode: no checks for busy waiting or data races\n");
+        if (minheap_empty(global->failures)) {
+            extmem_analyze(global, &workers[0].inv_step);
+        }
+    }
+    else if (minheap_empty(global->failures)) {
         if (global->graph.size > 10000) {
             printf("* Phase 3b: strongly connected components\n");
             fflush(stdout);
         }
         double now = gettime();
+        if (csr) {
+            struct csr *c = csr_build(&global->graph);
+            global->graph.csr = c;
+            printf("    * compressed graph: %u nodes, %"PRIu64" edges (%.2lf seconds)\n",
+                    c->nnodes, c->nedges, gettime() - now);
+            now = gettime();
+        }
         global->phase2 = true;
-        global->scc_todo = scc_alloc(0, global->graph.size, NULL, NULL);
+        struct node *root = global->graph.nodes[0];
+        struct scc_pool *pool = scc_pool_new(global, global->nworkers);
+        for (unsigned int i = 0; i < global->nworkers; i++) {
+            scc_workers[i].pool = pool;
+        }
 
         // Start all but one of the workers, who'll wait on the start barrier
         for (unsigned int i = 1; i < global->nworkers; i++) {
@@ -2877,7 +5010,88 @@ int main(int argc, char **argv){
         }
         scc_worker(&scc_workers[0]);
 
-        printf("    * %u components (%.2lf seconds)\n", global->ncomponents, gettime() - now);
+        global->ncomponents = scc_pool_ncomponents(pool);
+        double done = gettime();
+        if (pool->trim) {
+            printf("    * trimming: %u trivial components (%.2lf seconds)\n",
+                    pool->ntrimmed, pool->trimmed_at - now);
+            printf("    * partitioning: %u states left (%.2lf seconds)\n",
+                    pool->nnodes - pool->ntrimmed, done - pool->trimmed_at);
+        }
+        printf("    * %u components (%.2lf seconds)\n", global->ncomponents, done - now);
+        scc_pool_free(pool);
+
+        // The paths to the states are built from the initial state, which
+        // trimming or partitioning may have moved
+        if (global->graph.nodes[0] != root) {
+            struct node *other = global->graph.nodes[0];
+            global->graph.nodes[root->id] = other;
+            other->id = root->id;
+            global->graph.nodes[0] = root;
+            root->id = 0;
+        }
+
+        // Classify the components and check the final states (see
+        // classify_worker()).  Evaluating finally clauses may create
+        // values, so the value dictionaries need to be concurrent.
+        struct component *components = calloc(global->ncomponents, sizeof(*components));
+        struct classify cl;
+        cl.nworkers = global->nworkers;
+#ifndef USE_ATOMIC
+        cl.nworkers = 1;
+#endif
+        cl.components = components;
+        cl.size = malloc(global->ncomponents * sizeof(*cl.size));
+        cl.rep = malloc(global->ncomponents * sizeof(*cl.rep));
+        cl.good = malloc(global->ncomponents * sizeof(*cl.good));
+        cl.mixed = malloc(global->ncomponents * sizeof(*cl.mixed));
+        cl.failed = calloc(cl.nworkers, sizeof(*cl.failed));
+        for (unsigned int i = 0; i < global->ncomponents; i++) {
+#ifdef USE_ATOMIC
+            atomic_init(&cl.size[i], 0);
+            atomic_init(&cl.rep[i], UINT32_MAX);
+            atomic_init(&cl.good[i], false);
+            atomic_init(&cl.mixed[i], false);
+#else
+            cl.size[i] = 0;
+            cl.rep[i] = UINT32_MAX;
+            cl.good[i] = cl.mixed[i] = false;
+#endif
+        }
+        bool concurrent = cl.nworkers > 1 && global->nfinals > 0;
+        if (concurrent) {
+            for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+                dict_set_concurrent(global->values[i]);
+            }
+        }
+        for (unsigned int i = 0; i < cl.nworkers; i++) {
+            scc_workers[i].classify = &cl;
+        }
+        for (unsigned int i = 1; i < cl.nworkers; i++) {
+            thread_create(classify_worker, &scc_workers[i]);
+        }
+        classify_worker(&scc_workers[0]);
+        if (concurrent) {
+            for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+                dict_grow_prepare(global->values[i]);
+                for (unsigned int j = 0; j < global->nworkers; j++) {
+                    dict_make_stable(global->values[i], j);
+                }
+                dict_set_sequential(global->values[i]);
+            }
+        }
+        free(cl.size);
+        free(cl.rep);
+        free(cl.good);
+        free(cl.mixed);
+        free(cl.failed);
+
+        // The components are now in the nodes, so the compressed graph is
+        // no longer needed
+        if (global->graph.csr != NULL) {
+            csr_free(global->graph.csr);
+            global->graph.csr = NULL;
+        }
 
 #ifdef DUMP_GRAPH
         printf("digraph Harmony {\n");
@@ -2894,118 +5108,28 @@ int main(int argc, char **argv){
         printf("}\n");
 #endif
 
-        // mark the components that are "good" because they have a way out
-        struct component *components = calloc(global->ncomponents, sizeof(*components));
-        for (unsigned int i = 0; i < global->graph.size; i++) {
-            struct node *node = global->graph.nodes[i];
-			assert(node->component < global->ncomponents);
-            struct component *comp = &components[node->component];
-            if (comp->size == 0) {
-                comp->rep = node;
-                comp->all_same = value_state_all_eternal(node->state)
-                    && value_ctx_all_eternal(node->state->stopbag);
-            }
-            else if (node->state->vars != comp->rep->state->vars ||
-                        !value_state_all_eternal(node->state) ||
-                        !value_ctx_all_eternal(node->state->stopbag)) {
-                comp->all_same = false;
-            }
-            comp->size++;
-            if (comp->good) {
-                continue;
-            }
-            // if this component has a way out, it is good
-            for (struct edge *edge = node->fwd;
-                            edge != NULL && !comp->good; edge = edge->fwdnext) {
-                if (edge->dst->component != node->component) {
-                    comp->good = true;
-                    break;
-                }
-            }
-        }
-
-        // components that have only one shared state and only eternal
-        // threads are good because it means all its threads are blocked
-        for (unsigned int i = 0; i < global->ncomponents; i++) {
-            struct component *comp = &components[i];
-            assert(comp->size > 0);
-            if (!comp->good && comp->all_same) {
-                comp->good = true;
-                comp->final = true;
-            }
-        }
-
-        // Create a context for evaluating finally clauses
-        struct step fin_step;
-        memset(&fin_step, 0, sizeof(fin_step));
-        fin_step.ctx = calloc(1, sizeof(struct context) +
-                                MAX_CONTEXT_STACK * sizeof(hvalue_t));
-        fin_step.ctx->vars = VALUE_DICT;
-        fin_step.ctx->atomic = fin_step.ctx->readonly = 1;
-        fin_step.ctx->atomicFlag = true;
-        fin_step.ctx->interruptlevel = false;
-        fin_step.engine.allocator = &workers[0].allocator;
-        fin_step.engine.values = global->values;
-
-        // Look for states in final components
-        for (unsigned int i = 0; i < global->graph.size; i++) {
-            struct node *node = global->graph.nodes[i];
-			assert(node->component < global->ncomponents);
-            struct component *comp = &components[node->component];
-            if (comp->final) {
-                node->final = true;
-                if (global->dfa != NULL &&
-						!dfa_is_final(global->dfa, node->state->dfa_state)) {
-                    struct failure *f = new_alloc(struct failure);
-                    f->type = FAIL_BEHAVIOR;
-                    f->edge = node->to_parent;
-                    minheap_insert(global->failures, f);
-                    // break;
-                }
-
-                // Check "finally" clauses
-                unsigned int fin = check_finals(global, node, &fin_step);
-                if (fin != 0) {
-                    struct failure *f = new_alloc(struct failure);
-                    f->type = FAIL_FINALLY;
-                    f->edge = node->to_parent;
-                    f->address = VALUE_TO_PC(fin);
-                    minheap_insert(global->failures, f);
-                }
-            }
+        // Failures of final states come before those of states in bad
+        // components, which are only found if there are no other failures
+        unsigned int nbad = 0;
+        for (unsigned int i = 0; i < cl.nworkers; i++) {
+            nbad += scc_workers[i].nbad;
         }
+        scc_worker_failures(global, scc_workers);
 
-        if (minheap_empty(global->failures)) {
-            // now count the nodes that are in bad components
-            int nbad = 0;
-            for (unsigned int i = 0; i < global->graph.size; i++) {
-                struct node *node = global->graph.nodes[i];
-                if (!components[node->component].good) {
-                    nbad++;
-                    struct failure *f = new_alloc(struct failure);
-                    f->type = FAIL_TERMINATION;
-                    if (node->fwd != NULL && node->fwd->fwdnext == NULL) {
-                        f->edge = node->fwd;
-                    }
-                    else {
-                        f->edge = node->to_parent;
-                    }
-                    minheap_insert(global->failures, f);
-                    // break;
-                }
+        if (nbad == 0 && minheap_empty(global->failures) && !cflag) {
+            struct busywait_pool bw;
+            busywait_prepare(&bw, global, components);
+            for (unsigned int i = 0; i < global->nworkers; i++) {
+                scc_workers[i].busywait = &bw;
             }
-
-            if (nbad == 0 && !cflag) {
-                for (unsigned int i = 0; i < global->graph.size; i++) {
-                    global->graph.nodes[i]->visited = false;
-                }
-                for (unsigned int i = 0; i < global->graph.size; i++) {
-                    struct node *node = global->graph.nodes[i];
-                    if (components[node->component].size > 1) {
-                        detect_busywait(global->failures, node);
-                    }
-                }
+            for (unsigned int i = 1; i < global->nworkers; i++) {
+                thread_create(busywait_worker, &scc_workers[i]);
             }
+            busywait_worker(&scc_workers[0]);
+            scc_worker_failures(global, scc_workers);
+            free(bw.first);
+            free(bw.members);
+            free(bw.rank);
         }
     }
 
@@ -3128,21 +5252,48 @@ int main(int argc, char **argv){
     }
 
     // Look for data races
-    // TODO.  Can easily be parallelized
 	// TODO.  Don't need failures/warnings distinction any more
     struct minheap *warnings = minheap_create(fail_cmp);
-    if (!Rflag && minheap_empty(global->failures)) {
+    if (!Rflag && global->bitstate == NULL && global->swarm == 0 &&
+                    global->walks == 0 && global->extmem == NULL &&
+                    minheap_empty(global->failures)) {
         printf("    * Check for data races\n");
-        for (unsigned int i = 0; i < global->graph.size; i++) {
-            struct node *node = global->graph.nodes[i];
+        struct race_pool rp;
+#ifdef USE_ATOMIC
+        atomic_init(&rp.next, 0);
+        atomic_init(&rp.first, global->graph.size);
+#else
+        mutex_init(&rp.lock);
+        rp.next = 0;
+        rp.first = global->graph.size;
+#endif
+        for (unsigned int i = 0; i < global->nworkers; i++) {
+            scc_workers[i].races = &rp;
+        }
+        for (unsigned int i = 1; i < global->nworkers; i++) {
+            thread_create(race_worker, &scc_workers[i]);
+        }
+        race_worker(&scc_workers[0]);
+
+        // Report the data races of the first state that has any
+#ifdef USE_ATOMIC
+        unsigned int first = atomic_load(&rp.first);
+#else
+        unsigned int first = rp.first;
+#endif
+        if (first < global->graph.size) {
+            struct node *node = global->graph.nodes[first];
             graph_check_for_data_race(node, warnings, &engine);
-            if (!minheap_empty(warnings)) {
-                break;
-            }
+            assert(!minheap_empty(warnings));
         }
     }
 
     bool no_issues = minheap_empty(global->failures) && minheap_empty(warnings);
+    if (no_issues && global->out_of_memory) {
+        // Part of the state space was not explored
+        printf("    * no issues found in the states explored, but the search is incomplete\n");
+        exit(1);
+    }
     if (no_issues) {
         printf("    * **No issues found**\n");
     }
@@ -3376,11 +5527,43 @@ int main(int argc, char **argv){
 
         // printf("LEN=%u, STEPS=%u\n", bad->edge->dst->len, bad->edge->dst->steps);
 
+        // The states found by a swarm search or random walk are not in
+        // the graph, so number the ones on the path
+        if (global->swarm != 0 || global->walks != 0) {
+            for (struct node *n = bad->edge->dst; n->to_parent != NULL; n = n->to_parent->src) {
+                n->id = n->len;
+            }
+        }
+
+        // A failure found by an external-memory search comes from a state
+        // that was read from disk without the path to it
+        if (global->extmem != NULL && bad->edge->src->to_parent == NULL &&
+                                    bad->edge->src != global->graph.nodes[0]) {
+            bad->edge->src = extmem_path(global->extmem, bad->edge->src->id,
+                                                    global->graph.nodes[0]);
+        }
+
         fprintf(out, "  \"macrosteps\": [");
         path_serialize(global, edge);
-        path_optimize(global);
+
+        // Reordering the path needs the forward edges of the graph, which
+        // are not kept in bitstate, swarm, random-walk, or external-memory
+        // mode, and may be missing in async and on-the-fly mode as the
+        // search stops at the first failure while states closer to the
+        // initial state may not have been expanded yet.  With partial-order
+        // reduction the graph may not have the interleavings that the
+        // reordering would produce.
+        if (global->bitstate == NULL && global->swarm == 0 && global->walks == 0 &&
+                            global->extmem == NULL && !global->async &&
+                            !global->onthefly && !global->por) {
+            path_optimize(global);
+        }
         path_recompute(global);
-        if (bad->type == FAIL_INVARIANT || bad->type == FAIL_SAFETY) {
+
+        // Trimming needs the access information of the edges, which is not
+        // written to disk in external-memory mode
+        if ((bad->type == FAIL_INVARIANT || bad->type == FAIL_SAFETY) &&
+                                                global->extmem == NULL) {
             path_trim(global, &engine);
         }
         path_output(global, out);
@@ -50,7 +50,7 @@ struct macrostep {
 
 struct global {
     struct code code;               // code of the Harmony program
-    struct dict *values;            // dictionary of values
+    struct dict **values;           // value store shards (see value.h)
     hvalue_t seqs;                  // sequential variables
 
     // invariants
@@ -62,20 +62,32 @@ struct global {
     unsigned int *finals;           // program counters of finally preds
 
     struct graph graph;             // the Kripke structure
+    bool layer_done;                // all states in a layer completed
+    bool async;                     // explore without rounds or barriers
+    bool por;                       // partial-order reduction
+    struct bitstate *bitstate;      // visited bits in bitstate mode, or NULL
+    unsigned int swarm;             // #searches in swarm mode, or 0
+    unsigned int swarm_states;      // swarm mode: max #states per search
+    unsigned int swarm_depth;       // swarm mode: max depth of a search
+    unsigned int walks;             // #walks in random-walk mode, or 0
+    unsigned int walk_depth;        // random-walk mode: max #steps of a walk
+    uint64_t walk_seed;             // random-walk mode: seed of first walk
+    struct extmem *extmem;          // external-memory mode, or NULL
+    struct checkpoint *checkpoint;  // checkpoint file (-C), or NULL
+    bool first_failure;             // stop at first safety violation
+    bool onthefly;                  // termination checked during the search
+    uint64_t max_memory;            // memory budget in bytes, or 0
+    unsigned int degraded;          // #states when the budget was neared, or 0
+    bool out_of_memory;             // search stopped at the memory budget
+    unsigned int unexplored;        // #states left when stopped
 #ifdef USE_ATOMIC
-    hAtomic(unsigned int) atodo;
-#else
-    mutex_t todo_lock;              // to access the todo list
-    unsigned int todo;
+    hAtomic(bool) stop;             // async, swarm, random walk, external memory,
+                                    // and first failure found (--first-failure)
+    hAtomic(unsigned int) swarm_next;   // swarm, random walk, external memory: next to run
 #endif
-    unsigned int goal;
-    bool layer_done;                // all states in a layer completed
     bool printed_something;         // see if anything was printed
 
-    mutex_t todo_enter;             // entry semaphore for SCC tasks
-    mutex_t todo_wait;              // wait semaphore for SCC tasks
     unsigned int nworkers;          // total number of threads
-    unsigned int scc_nwaiting;      // # workers waiting for SCC work
     unsigned int ncomponents;       // to generate component identifiers
     struct minheap *failures;       // queue of "struct failure"  (TODO: make part of struct node "issues")
     hvalue_t *processes;            // array of contexts of processes
@@ -86,7 +98,6 @@ struct global {
     struct dfa *dfa;                // for tracking correct behaviors
     unsigned int diameter;          // graph diameter
     bool phase2;                    // when model checking is done and graph analysis starts
-    struct scc *scc_todo;           // SCC search
     struct json_value *pretty;      // for output
     bool run_direct;                // non-model-checked mode
     unsigned long allocated;        // allocated table space
@@ -0,0 +1,606 @@
+#include "head.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "global.h"
+#include "value.h"
+#include "graph.h"
+#include "hashdict.h"
+#include "charm.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC    "CHARMCP"
+#define CHECKPOINT_VERSION  1
+
+// A checkpoint file consists of this header, the invariants and the
+// finally predicates, the values (ending with a record with old == 0),
+// the nodes, and the forward edges of the nodes before the last layer.
+// Every record and everything that follows it is padded to a multiple
+// of 8 bytes, so the hvalue_t's in the mapped file are aligned.
+struct cp_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t state_size, context_size, edge_size;   // layout of this binary
+    uint64_t fingerprint;
+    uint32_t nnodes, layer_start, diameter;
+    uint32_t ninvs, nfinals, inv_pre;
+};
+
+// A value, followed by its contents
+struct cp_value {
+    hvalue_t old;           // the value in the run that wrote the file
+    uint64_t size;          // size of the contents
+};
+
+// A node, followed by its state
+struct cp_node {
+    uint32_t size;          // size of the state
+    uint16_t len, steps;
+    uint8_t failed;
+    uint8_t pad[7];
+};
+
+// An edge, followed by its print log and its access information.  The
+// edges of a node are preceded by their number (a uint64_t).
+struct cp_edge {
+    uint32_t dst;           // destination node
+    uint32_t nai;           // #access_info records
+    uint16_t nsteps, multiplicity, nlog;
+    uint8_t flags;
+    uint8_t pad;
+    hvalue_t ctx, choice, after;
+};
+#define CP_INTERRUPT    0x1
+#define CP_CHOOSING     0x2
+#define CP_FAILED       0x4
+#define CP_TO_PARENT    0x8     // the edge is edge->dst->to_parent
+
+// Access information, followed by the indices
+struct cp_access {
+    uint8_t n;
+    uint8_t atomic, load;
+    uint8_t pad[5];
+};
+
+struct checkpoint *checkpoint_new(const char *file, double interval, uint64_t fingerprint){
+    struct checkpoint *cp = new_alloc(struct checkpoint);
+    cp->file = malloc(strlen(file) + 1);
+    strcpy(cp->file, file);
+    cp->interval = interval;
+    cp->last = gettime();
+    cp->fingerprint = fingerprint;
+    mutex_init(&cp->lock);
+    return cp;
+}
+
+// Whether the value is the address of an entry in the value store
+static bool cp_pointer(hvalue_t v){
+    switch (VALUE_TYPE(v)) {
+    case VALUE_ATOM:
+    case VALUE_LIST:
+    case VALUE_DICT:
+    case VALUE_SET:
+    case VALUE_ADDRESS_SHARED:
+    case VALUE_ADDRESS_PRIVATE:
+    case VALUE_CONTEXT:
+        return (v & ~VALUE_MASK) != 0;
+    default:
+        return false;
+    }
+}
+
+static void cp_write(FILE *out, const void *p, size_t size){
+    static const char zeros[8];
+    if (size > 0) {
+        fwrite(p, 1, size, out);
+        fwrite(zeros, 1, (8 - size % 8) % 8, out);
+    }
+}
+
+// Write a value, after the values it refers to that have not been
+// written yet
+static void cp_write_value(FILE *out, struct dict *written, hvalue_t v){
+    if (!cp_pointer(v)) {
+        return;
+    }
+    hvalue_t key = v & ~VALUE_MASK;
+    bool new;
+    dict_insert(written, NULL, &key, sizeof(key), &new);
+    if (!new) {
+        return;
+    }
+
+    unsigned int size, n = 0;
+    void *p = value_get(v, &size);
+    hvalue_t *vals = p;
+    if (VALUE_TYPE(v) == VALUE_CONTEXT) {
+        struct context *ctx = p;
+        cp_write_value(out, written, ctx->vars);
+        vals = (hvalue_t *) &ctx[1];
+        n = (size - sizeof(*ctx)) / sizeof(hvalue_t);
+    }
+    else if (VALUE_TYPE(v) != VALUE_ATOM) {
+        n = size / sizeof(hvalue_t);
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        cp_write_value(out, written, vals[i]);
+    }
+
+    struct cp_value cv = { v & ~VALUE_HIBITS, size };
+    cp_write(out, &cv, sizeof(cv));
+    cp_write(out, p, size);
+}
+
+static void cp_write_values(FILE *out, struct checkpoint *cp){
+    struct dict *written = dict_new("checkpoint", 0, 0, 0, false);
+    for (unsigned int i = 0; i < cp->nnodes; i++) {
+        struct state *state = cp->nodes[i]->state;
+        cp_write_value(out, written, state->vars);
+        cp_write_value(out, written, state->pre);
+        cp_write_value(out, written, state->choosing);
+        cp_write_value(out, written, state->stopbag);
+        for (unsigned int j = 0; j < state->bagsize; j++) {
+            cp_write_value(out, written, state_contexts(state)[j]);
+        }
+    }
+    for (unsigned int i = 0; i < cp->layer_start; i++) {
+        for (struct edge *e = cp->nodes[i]->fwd; e != NULL; e = e->fwdnext) {
+            cp_write_value(out, written, e->ctx);
+            cp_write_value(out, written, e->choice);
+            cp_write_value(out, written, e->after);
+            for (unsigned int j = 0; j < e->nlog; j++) {
+                cp_write_value(out, written, edge_log(e)[j]);
+            }
+            for (struct access_info *ai = e->ai; ai != NULL; ai = ai->next) {
+                for (unsigned int j = 0; j < ai->n; j++) {
+                    cp_write_value(out, written, ai->indices[j]);
+                }
+            }
+        }
+    }
+    struct cp_value end = { 0, 0 };
+    cp_write(out, &end, sizeof(end));
+    dict_delete(written);
+}
+
+static void cp_write_edges(FILE *out, struct checkpoint *cp){
+    for (unsigned int i = 0; i < cp->layer_start; i++) {
+        uint64_t count = 0;
+        for (struct edge *e = cp->nodes[i]->fwd; e != NULL; e = e->fwdnext) {
+            count++;
+        }
+        cp_write(out, &count, sizeof(count));
+        for (struct edge *e = cp->nodes[i]->fwd; e != NULL; e = e->fwdnext) {
+            struct cp_edge ce;
+            memset(&ce, 0, sizeof(ce));
+            ce.dst = e->dst->id;
+            for (struct access_info *ai = e->ai; ai != NULL; ai = ai->next) {
+                ce.nai++;
+            }
+            ce.nsteps = e->nsteps;
+            ce.multiplicity = e->multiplicity;
+            ce.nlog = e->nlog;
+            ce.flags = (e->interrupt ? CP_INTERRUPT : 0) |
+                        (e->choosing ? CP_CHOOSING : 0) |
+                        (e->failed ? CP_FAILED : 0) |
+                        (e->dst->to_parent == e ? CP_TO_PARENT : 0);
+            ce.ctx = e->ctx;
+            ce.choice = e->choice;
+            ce.after = e->after;
+            cp_write(out, &ce, sizeof(ce));
+            cp_write(out, edge_log(e), e->nlog * sizeof(hvalue_t));
+            for (struct access_info *ai = e->ai; ai != NULL; ai = ai->next) {
+                struct cp_access ca;
+                memset(&ca, 0, sizeof(ca));
+                ca.n = ai->n;
+                ca.atomic = ai->atomic;
+                ca.load = ai->load;
+                cp_write(out, &ca, sizeof(ca));
+                cp_write(out, ai->indices, ai->n * sizeof(hvalue_t));
+            }
+        }
+    }
+}
+
+// The checkpoint being written, if any, is done
+static void cp_done(struct checkpoint *cp){
+    mutex_acquire(&cp->lock);
+    cp->busy = false;
+    mutex_release(&cp->lock);
+}
+
+// Runs in its own thread.  Clears cp->busy when done.
+static void cp_writer(void *arg){
+    struct checkpoint *cp = arg;
+    struct global *global = cp->global;
+    char *tmp = malloc(strlen(cp->file) + 5);
+    sprintf(tmp, "%s.tmp", cp->file);
+    FILE *out = fopen(tmp, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "charm: can't create %s\n", tmp);
+        free(tmp);
+        free(cp->nodes);
+        cp_done(cp);
+        return;
+    }
+
+    struct cp_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    strcpy(hdr.magic, CHECKPOINT_MAGIC);
+    hdr.version = CHECKPOINT_VERSION;
+    hdr.state_size = sizeof(struct state);
+    hdr.context_size = sizeof(struct context);
+    hdr.edge_size = sizeof(struct edge);
+    hdr.fingerprint = cp->fingerprint;
+    hdr.nnodes = cp->nnodes;
+    hdr.layer_start = cp->layer_start;
+    hdr.diameter = cp->diameter;
+    mutex_acquire(&global->inv_lock);
+    hdr.ninvs = global->ninvs;
+    hdr.nfinals = global->nfinals;
+    hdr.inv_pre = global->inv_pre;
+    cp_write(out, &hdr, sizeof(hdr));
+    cp_write(out, global->invs, hdr.ninvs * sizeof(*global->invs));
+    cp_write(out, global->finals, hdr.nfinals * sizeof(*global->finals));
+    mutex_release(&global->inv_lock);
+
+    cp_write_values(out, cp);
+    for (unsigned int i = 0; i < cp->nnodes; i++) {
+        struct node *node = cp->nodes[i];
+        struct cp_node cn;
+        memset(&cn, 0, sizeof(cn));
+        cn.size = state_size(node->state);
+        cn.len = node->len;
+        cn.steps = node->steps;
+        cn.failed = node->failed;
+        cp_write(out, &cn, sizeof(cn));
+        cp_write(out, node->state, cn.size);
+    }
+    cp_write_edges(out, cp);
+
+    bool ok = fflush(out) == 0 && !ferror(out);
+    ok = fclose(out) == 0 && ok;
+    if (ok) {
+#ifdef _WIN32
+        (void) remove(cp->file);
+#endif
+        ok = rename(tmp, cp->file) == 0;
+    }
+    if (ok) {
+        cp->count++;
+    }
+    else {
+        fprintf(stderr, "charm: can't write checkpoint %s\n", cp->file);
+        (void) remove(tmp);
+    }
+    free(tmp);
+    free(cp->nodes);
+    cp->nodes = NULL;
+    cp_done(cp);
+}
+
+// Called by the coordinator between rounds, after the nodes of a new
+// layer, starting at layer_start, have been added to the graph.  Starts
+// writing a checkpoint if it is time and the last one has been written.
+void checkpoint_layer(struct checkpoint *cp, struct global *global, unsigned int layer_start){
+    double now = gettime();
+    if (now - cp->last < cp->interval) {
+        return;
+    }
+    mutex_acquire(&cp->lock);
+    bool busy = cp->busy;
+    cp->busy = true;
+    mutex_release(&cp->lock);
+    if (busy) {
+        return;
+    }
+    cp->last = now;
+    cp->global = global;
+    cp->nnodes = global->graph.size;
+    cp->nodes = malloc(cp->nnodes * sizeof(*cp->nodes));
+    memcpy(cp->nodes, global->graph.nodes, cp->nnodes * sizeof(*cp->nodes));
+    cp->layer_start = layer_start;
+    cp->diameter = global->diameter;
+    thread_create(cp_writer, cp);
+}
+
+// The search is over.  Wait for the checkpoint being written, if any,
+// and remove the checkpoint file.
+void checkpoint_remove(struct checkpoint *cp){
+    for (;;) {
+        mutex_acquire(&cp->lock);
+        bool busy = cp->busy;
+        mutex_release(&cp->lock);
+        if (!busy) {
+            break;
+        }
+        thread_yield();
+    }
+    char *tmp = malloc(strlen(cp->file) + 5);
+    sprintf(tmp, "%s.tmp", cp->file);
+    (void) remove(tmp);
+    (void) remove(cp->file);
+    free(tmp);
+}
+
+// For reading the mapped file
+struct cp_reader {
+    char *next, *end;
+};
+
+static void *cp_read(struct cp_reader *r, uint64_t size){
+    char *p = r->next;
+    size = (size + 7) & ~(uint64_t) 7;
+    if (size > (uint64_t) (r->end - p)) {
+        panic("checkpoint_load: truncated file");
+    }
+    r->next += size;
+    return p;
+}
+
+// Translate a value from the run that wrote the checkpoint
+static hvalue_t cp_reloc(struct dict *map, hvalue_t v){
+    if (!cp_pointer(v)) {
+        return v;
+    }
+    hvalue_t old = v & ~VALUE_MASK;
+    void *p = dict_lookup(map, &old, sizeof(old));
+    if (p == NULL) {
+        panic("checkpoint_load: unknown value");
+    }
+    return (hvalue_t) p | (v & VALUE_MASK);
+}
+
+static int cp_value_cmp(const void *v1, const void *v2){
+    return value_cmp(* (const hvalue_t *) v1, * (const hvalue_t *) v2);
+}
+
+// Sets and the keys of dicts are sorted with value_cmp(), which for
+// contexts depends on the values they refer to, and thus on where those
+// are stored.  So they are sorted again.
+static hvalue_t cp_intern(struct engine *engine, struct dict *map,
+                                hvalue_t old, void *contents, unsigned int size){
+    if (VALUE_TYPE(old) == VALUE_ATOM) {
+        return value_put_atom(engine, contents, size);
+    }
+    hvalue_t *vals = malloc(size);
+    memcpy(vals, contents, size);
+    unsigned int n = size / sizeof(hvalue_t);
+    hvalue_t v;
+    switch (VALUE_TYPE(old)) {
+    case VALUE_SET:
+        for (unsigned int i = 0; i < n; i++) {
+            vals[i] = cp_reloc(map, vals[i]);
+        }
+        qsort(vals, n, sizeof(hvalue_t), cp_value_cmp);
+        v = value_put_set(engine, vals, size);
+        break;
+    case VALUE_DICT:
+        for (unsigned int i = 0; i < n; i++) {
+            vals[i] = cp_reloc(map, vals[i]);
+        }
+        qsort(vals, n / 2, 2 * sizeof(hvalue_t), cp_value_cmp);
+        v = value_put_dict(engine, vals, size);
+        break;
+    case VALUE_LIST:
+        for (unsigned int i = 0; i < n; i++) {
+            vals[i] = cp_reloc(map, vals[i]);
+        }
+        v = value_put_list(engine, vals, size);
+        break;
+    case VALUE_ADDRESS_SHARED:
+    case VALUE_ADDRESS_PRIVATE:
+        for (unsigned int i = 0; i < n; i++) {
+            vals[i] = cp_reloc(map, vals[i]);
+        }
+        v = value_put_address(engine, vals, size);
+        break;
+    case VALUE_CONTEXT:
+        {
+            struct context *ctx = (struct context *) vals;
+            hvalue_t *stack = (hvalue_t *) &ctx[1];
+            ctx->vars = cp_reloc(map, ctx->vars);
+            for (unsigned int i = 0; i < (size - sizeof(*ctx)) / sizeof(hvalue_t); i++) {
+                stack[i] = cp_reloc(map, stack[i]);
+            }
+            v = value_put_context(engine, ctx);
+        }
+        break;
+    default:
+        panic("checkpoint_load: bad value type");
+        v = 0;
+    }
+    free(vals);
+    return v;
+}
+
+// Rebuild a state with translated values.  The bag of contexts is
+// sorted by value, so it is built again as well.
+static void cp_state(struct dict *map, struct state *saved, struct state *sc){
+    memset(sc, 0, sizeof(*sc));
+    sc->vars = cp_reloc(map, saved->vars);
+    sc->pre = cp_reloc(map, saved->pre);
+    sc->choosing = cp_reloc(map, saved->choosing);
+    sc->stopbag = cp_reloc(map, saved->stopbag);
+    sc->dfa_state = saved->dfa_state;
+    sc->tid_gen = saved->tid_gen;
+    for (unsigned int i = 0; i < saved->bagsize; i++) {
+        hvalue_t ctx = cp_reloc(map, state_contexts(saved)[i]);
+        for (unsigned int j = 0; j < multiplicities(saved)[i]; j++) {
+            context_add(sc, ctx);
+        }
+    }
+}
+
+// Resume from the checkpoint file, if there is one.  The graph, the visited
+// states, the value store, the invariants, and the finally predicates are
+// restored.  The nodes starting at *layer_start still have to be expanded.
+// The dictionaries must be in concurrent mode, and should be made stable
+// afterwards.
+bool checkpoint_load(struct checkpoint *cp, struct global *global, struct dict *visited,
+                                struct allocator *al, unsigned int *layer_start){
+    char *base;
+    uint64_t size;
+#ifdef _WIN32
+    FILE *fp = fopen(cp->file, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    base = malloc(size);
+    if (fread(base, 1, size, fp) != size) {
+        panic("checkpoint_load: can't read file");
+    }
+    fclose(fp);
+#else
+    int fd = open(cp->file, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        panic("checkpoint_load: can't stat file");
+    }
+    size = st.st_size;
+    base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        panic("checkpoint_load: can't map file");
+    }
+    close(fd);
+#endif
+    struct cp_reader r = { base, base + size };
+
+    struct cp_header *hdr = cp_read(&r, sizeof(*hdr));
+    if (strcmp(hdr->magic, CHECKPOINT_MAGIC) != 0 ||
+                hdr->version != CHECKPOINT_VERSION ||
+                hdr->state_size != sizeof(struct state) ||
+                hdr->context_size != sizeof(struct context) ||
+                hdr->edge_size != sizeof(struct edge)) {
+        fprintf(stderr, "charm: %s is not a checkpoint of this version of charm\n", cp->file);
+        exit(1);
+    }
+    if (hdr->fingerprint != cp->fingerprint) {
+        fprintf(stderr, "charm: checkpoint %s is for another model or other options\n", cp->file);
+        exit(1);
+    }
+
+    // The arrays were allocated for the same code (see ops_predicates_alloc())
+    memcpy(global->invs, cp_read(&r, hdr->ninvs * sizeof(*global->invs)),
+                                    hdr->ninvs * sizeof(*global->invs));
+    memcpy(global->finals, cp_read(&r, hdr->nfinals * sizeof(*global->finals)),
+                                    hdr->nfinals * sizeof(*global->finals));
+    global->ninvs = hdr->ninvs;
+    global->nfinals = hdr->nfinals;
+    global->inv_pre = hdr->inv_pre;
+
+    // Intern the values.  The map translates the address of a value in
+    // the run that wrote the checkpoint to its address in this one.
+    struct engine engine = { al, global->values };
+    struct dict *map = dict_new("checkpoint", sizeof(hvalue_t), 0, 0, false);
+    for (;;) {
+        struct cp_value *cv = cp_read(&r, sizeof(*cv));
+        if (cv->old == 0) {
+            break;
+        }
+        hvalue_t v = cp_intern(&engine, map, cv->old, cp_read(&r, cv->size), cv->size);
+        hvalue_t key = cv->old & ~VALUE_MASK;
+        bool new;
+        hvalue_t *p = dict_insert(map, NULL, &key, sizeof(key), &new);
+        assert(new);
+        *p = v & ~VALUE_MASK;
+    }
+
+    // Put the states in the visited map and the graph
+    struct state *sc = malloc(sizeof(struct state) + MAX_CONTEXT_BAG * (sizeof(hvalue_t) + 1));
+    for (unsigned int i = 0; i < hdr->nnodes; i++) {
+        struct cp_node *cn = cp_read(&r, sizeof(*cn));
+        cp_state(map, cp_read(&r, cn->size), sc);
+        mutex_t *lock;
+        bool new;
+        struct dict_assoc *hn = dict_find_lock_hashed(visited, al, sc,
+                            state_size(sc), state_hash(sc), &new, &lock);
+        assert(new);
+        struct node *node = (struct node *) &hn[1];
+        memset(node, 0, sizeof(*node));
+        node->state = (struct state *) &node[1];
+        node->lock = lock;
+        node->initialized = true;
+        node->failed = cn->failed;
+        node->len = cn->len;
+        node->steps = cn->steps;
+        mutex_release(lock);
+        graph_add(&global->graph, node);
+    }
+    free(sc);
+
+    // Restore the edges
+    for (unsigned int i = 0; i < hdr->layer_start; i++) {
+        struct node *node = global->graph.nodes[i];
+        uint64_t count = * (uint64_t *) cp_read(&r, sizeof(count));
+        struct edge **last = &node->fwd;
+        while (count-- > 0) {
+            struct cp_edge *ce = cp_read(&r, sizeof(*ce));
+            if (ce->dst >= hdr->nnodes) {
+                panic("checkpoint_load: bad edge");
+            }
+            struct edge *e = (*al->alloc)(al->ctx,
+                    sizeof(struct edge) + ce->nlog * sizeof(hvalue_t), true, false);
+            e->src = node;
+            e->dst = global->graph.nodes[ce->dst];
+            e->ctx = cp_reloc(map, ce->ctx);
+            e->choice = cp_reloc(map, ce->choice);
+            e->after = cp_reloc(map, ce->after);
+            e->nsteps = ce->nsteps;
+            e->multiplicity = ce->multiplicity;
+            e->nlog = ce->nlog;
+            e->interrupt = (ce->flags & CP_INTERRUPT) != 0;
+            e->choosing = (ce->flags & CP_CHOOSING) != 0;
+            e->failed = (ce->flags & CP_FAILED) != 0;
+            hvalue_t *log = cp_read(&r, ce->nlog * sizeof(hvalue_t));
+            for (unsigned int j = 0; j < ce->nlog; j++) {
+                edge_log(e)[j] = cp_reloc(map, log[j]);
+            }
+            struct access_info **pai = &e->ai;
+            for (unsigned int j = 0; j < ce->nai; j++) {
+                struct cp_access *ca = cp_read(&r, sizeof(*ca));
+                hvalue_t *indices = cp_read(&r, ca->n * sizeof(hvalue_t));
+                struct access_info *ai = (*al->alloc)(al->ctx, sizeof(*ai), true, false);
+                ai->indices = (*al->alloc)(al->ctx, ca->n * sizeof(hvalue_t), false, false);
+                for (unsigned int k = 0; k < ca->n; k++) {
+                    ai->indices[k] = cp_reloc(map, indices[k]);
+                }
+                ai->n = ca->n;
+                ai->atomic = ca->atomic;
+                ai->load = ca->load;
+                *pai = ai;
+                pai = &ai->next;
+            }
+            *last = e;
+            last = &e->fwdnext;
+            e->bwdnext = e->dst->bwd;
+            e->dst->bwd = e;
+            if (ce->flags & CP_TO_PARENT) {
+                e->dst->to_parent = e;
+            }
+        }
+    }
+
+    global->diameter = hdr->diameter;
+    *layer_start = hdr->layer_start;
+    dict_delete(map);
+#ifdef _WIN32
+    free(base);
+#else
+    munmap(base, size);
+#endif
+    return true;
+}
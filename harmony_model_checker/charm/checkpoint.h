@@ -0,0 +1,53 @@
+#ifndef SRC_CHECKPOINT_H
+#define SRC_CHECKPOINT_H
+
+// Checkpoints (charm -C).  At the end of a layer of the breadth-first
+// search, if enough time has passed since the last checkpoint, the graph
+// up to and including the new layer is written to a file, together with
+// the values it refers to and the registered invariants and finally
+// predicates.  The nodes of the new layer have not been expanded yet, so
+// they are the frontier when the search is resumed from the file.
+//
+// The checkpoint is written by a separate thread while the search goes on.
+// This works because nodes before the new layer, their forward edges, and
+// values never change once they exist.  The file is written under a
+// temporary name and then renamed, so an interrupted run leaves the
+// previous checkpoint intact.
+//
+// Values are identified by their address, so they cannot be used as is in
+// another run.  They are written children first, and when loading, each
+// is interned again with the addresses of its children replaced.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "thread.h"
+
+struct global;
+struct dict;
+struct node;
+struct allocator;
+
+struct checkpoint {
+    char *file;                 // name of the checkpoint file
+    double interval;            // minimum #seconds between checkpoints
+    double last;                // time of the last checkpoint
+    uint64_t fingerprint;       // identifies the model and options
+    mutex_t lock;               // protects busy
+    bool busy;                  // a checkpoint is being written
+    unsigned int count;         // #checkpoints written
+
+    // The snapshot being written
+    struct global *global;
+    struct node **nodes;        // copy of the graph table
+    unsigned int nnodes;        // #nodes in the snapshot
+    unsigned int layer_start;   // first node of the new layer
+    unsigned int diameter;
+};
+
+struct checkpoint *checkpoint_new(const char *file, double interval, uint64_t fingerprint);
+void checkpoint_layer(struct checkpoint *cp, struct global *global, unsigned int layer_start);
+void checkpoint_remove(struct checkpoint *cp);
+bool checkpoint_load(struct checkpoint *cp, struct global *global, struct dict *visited,
+                                struct allocator *al, unsigned int *layer_start);
+
+#endif //SRC_CHECKPOINT_H
@@ -19,7 +19,7 @@ struct code {
 
 struct engine {
     struct allocator *allocator;
-    struct dict *values;
+    struct dict **values;       // one dictionary per shard (see value.h)
 };
 
 struct callstack {
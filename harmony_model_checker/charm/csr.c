@@ -0,0 +1,75 @@
+#include "head.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "global.h"
+#include "value.h"
+#include "graph.h"
+#include "charm.h"
+#include "csr.h"
+
+// Convert the graph.  The identifier of each node must be its index in
+// the graph table.  The forward edges of a node keep their order.
+struct csr *csr_build(struct graph *graph){
+    struct csr *csr = new_alloc(struct csr);
+    unsigned int n = graph->size;
+    csr->nnodes = n;
+
+    // Count the edges of each node
+    csr->fwd_index = malloc((n + 1) * sizeof(*csr->fwd_index));
+    csr->bwd_index = calloc(n + 1, sizeof(*csr->bwd_index));
+    uint64_t m = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        struct node *node = graph->nodes[i];
+        assert(node->id == i);
+        csr->fwd_index[i] = m;
+        for (struct edge *e = node->fwd; e != NULL; e = e->fwdnext) {
+            csr->bwd_index[e->dst->id + 1]++;
+            m++;
+        }
+    }
+    csr->fwd_index[n] = m;
+    csr->nedges = m;
+    for (unsigned int i = 0; i < n; i++) {
+        csr->bwd_index[i + 1] += csr->bwd_index[i];
+    }
+
+    // Fill in the forward edges.  The backward edges are filled in using
+    // bwd_index[i] as the next free slot of node i, after which it holds
+    // the start of node i + 1 and is shifted back.
+    csr->fwd_dst = malloc(m * sizeof(*csr->fwd_dst));
+    csr->bwd_src = malloc(m * sizeof(*csr->bwd_src));
+    for (unsigned int i = 0; i < n; i++) {
+        uint64_t k = csr->fwd_index[i];
+        for (struct edge *e = graph->nodes[i]->fwd; e != NULL; e = e->fwdnext, k++) {
+            uint32_t dst = e->dst->id;
+            csr->fwd_dst[k] = dst;
+            csr->bwd_src[csr->bwd_index[dst]++] = i;
+        }
+    }
+    for (unsigned int i = n; i > 0; i--) {
+        csr->bwd_index[i] = csr->bwd_index[i - 1];
+    }
+    csr->bwd_index[0] = 0;
+
+    csr->component = calloc(n, sizeof(*csr->component));
+    csr->perm = malloc(n * sizeof(*csr->perm));
+    csr->pos = malloc(n * sizeof(*csr->pos));
+    for (unsigned int i = 0; i < n; i++) {
+        csr->perm[i] = csr->pos[i] = i;
+    }
+    return csr;
+}
+
+void csr_free(struct csr *csr){
+    free(csr->fwd_index);
+    free(csr->fwd_dst);
+    free(csr->bwd_index);
+    free(csr->bwd_src);
+    free(csr->component);
+    free(csr->perm);
+    free(csr->pos);
+    free(csr);
+}
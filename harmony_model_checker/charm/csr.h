@@ -0,0 +1,129 @@
+#ifndef SRC_CSR_H
+#define SRC_CSR_H
+
+// Compressed sparse row form of the Kripke graph (charm --csr).  After the
+// search, the destinations of the forward edges and the sources of the
+// backward edges are copied into flat arrays indexed by node identifier,
+// so that the SCC decomposition and the component classification scan
+// consecutive 32-bit node identifiers instead of following pointers to
+// edges that are spread over the allocation chunks of all workers.
+//
+// The edges are still needed for counterexamples, destuttering, and the
+// checks that look at their contexts or access information, so they are
+// kept.  The compressed form thus takes memory in addition to the graph,
+// about 8 bytes per edge and 28 bytes per node.
+//
+// The analysis reaches the neighbors of a state through graph_succ(),
+// graph_pred(), and graph_next() below, which use the compressed form if
+// there is one and the edge lists otherwise.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "graph.h"
+
+struct csr {
+    unsigned int nnodes;
+    uint64_t nedges;
+
+    // The forward edges of node i are fwd_dst[fwd_index[i] .. fwd_index[i+1])
+    uint64_t *fwd_index;
+    uint32_t *fwd_dst;          // destination of each edge
+
+    // The backward edges of node i are bwd_src[bwd_index[i] .. bwd_index[i+1])
+    uint64_t *bwd_index;
+    uint32_t *bwd_src;          // source of each edge
+
+    // Strongly connected components
+    uint32_t *component;        // component of each node
+    uint32_t *perm;             // node at each position (see graph_at())
+    uint32_t *pos;              // position of each node
+};
+
+struct csr *csr_build(struct graph *graph);
+void csr_free(struct csr *csr);
+
+// For iterating over the successors or predecessors of a state
+struct graph_iter {
+    const uint32_t *next, *end; // compressed: remaining neighbors
+    struct edge *edge;          // edge lists: next edge
+    bool fwd;                   // edge lists: forward edges
+};
+
+static inline void graph_succ(struct graph *graph, uint32_t id, struct graph_iter *it){
+    struct csr *csr = graph->csr;
+    if (csr != NULL) {
+        it->next = &csr->fwd_dst[csr->fwd_index[id]];
+        it->end = &csr->fwd_dst[csr->fwd_index[id + 1]];
+        it->edge = NULL;
+        it->fwd = true;
+    }
+    else {
+        it->next = it->end = NULL;
+        it->edge = graph->nodes[id]->fwd;
+        it->fwd = true;
+    }
+}
+
+static inline void graph_pred(struct graph *graph, uint32_t id, struct graph_iter *it){
+    struct csr *csr = graph->csr;
+    if (csr != NULL) {
+        it->next = &csr->bwd_src[csr->bwd_index[id]];
+        it->end = &csr->bwd_src[csr->bwd_index[id + 1]];
+        it->edge = NULL;
+        it->fwd = false;
+    }
+    else {
+        it->next = it->end = NULL;
+        it->edge = graph->nodes[id]->bwd;
+        it->fwd = false;
+    }
+}
+
+// Get the next neighbor.  Returns false if there are none left.
+static inline bool graph_next(struct graph_iter *it, uint32_t *id){
+    if (it->next != it->end) {
+        *id = *it->next++;
+        return true;
+    }
+    struct edge *e = it->edge;
+    if (e == NULL) {
+        return false;
+    }
+    if (it->fwd) {
+        *id = e->dst->id;
+        it->edge = e->fwdnext;
+    }
+    else {
+        *id = e->src->id;
+        it->edge = e->bwdnext;
+    }
+    return true;
+}
+
+// The SCC decomposition reorders the states.  Without the compressed form
+// the nodes are moved in the graph table, so the identifier of a state is
+// its position.  With it only csr->perm and csr->pos change, so that node
+// identifiers stay valid.
+static inline uint32_t graph_pos(struct graph *graph, uint32_t id){
+    return graph->csr == NULL ? id : graph->csr->pos[id];
+}
+
+// The state at the given position
+static inline uint32_t graph_at(struct graph *graph, unsigned int pos){
+    return graph->csr == NULL ? pos : graph->csr->perm[pos];
+}
+
+static inline uint32_t graph_component(struct graph *graph, uint32_t id){
+    return graph->csr == NULL ? graph->nodes[id]->component : graph->csr->component[id];
+}
+
+static inline void graph_set_component(struct graph *graph, uint32_t id, uint32_t component){
+    if (graph->csr == NULL) {
+        graph->nodes[id]->component = component;
+    }
+    else {
+        graph->csr->component[id] = component;
+    }
+}
+
+#endif //SRC_CSR_H
@@ -0,0 +1,413 @@
+#include "head.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "global.h"
+#include "value.h"
+#include "graph.h"
+#include "hashdict.h"
+#include "extmem.h"
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#endif
+
+// The store, the visited partitions, and the candidate files all consist
+// of these records, each followed by an edge (esize bytes) and a state
+// (ssize bytes).  In candidate records, parent is the state that was
+// expanded and id is not used.  Visited records have no edge.
+struct extmem_record {
+    uint32_t id;            // state identifier
+    uint32_t parent;        // parent state, or EXTMEM_NONE
+    uint32_t steps;         // #microsteps from the initial state
+    uint16_t esize;         // size of the edge from the parent
+    uint16_t ssize;         // size of the state
+};
+
+#define EXTMEM_BUFSIZE  (1 << 17)
+
+// Create a scratch file in the given directory.  It is removed right away
+// so that it goes away when the model checker exits, even if it crashes.
+// (On Windows an open file cannot be removed, so the files stay behind.)
+// If reader is not NULL, the file is also opened for reading.
+static FILE *extmem_file(const char *dir, const char *name, FILE **reader){
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    sprintf(path, "%s/%s", dir, name);
+    FILE *f = fopen(path, "w+b");
+    if (f == NULL) {
+        free(path);
+        return NULL;
+    }
+    if (reader != NULL) {
+        *reader = fopen(path, "rb");
+        if (*reader == NULL) {
+            fclose(f);
+            remove(path);
+            free(path);
+            return NULL;
+        }
+    }
+    (void) remove(path);
+    free(path);
+    return f;
+}
+
+// Returns NULL if the files cannot be created in the given directory
+struct extmem *extmem_new(const char *dir, unsigned int npartitions){
+    assert(npartitions > 0);
+    struct extmem *em = new_alloc(struct extmem);
+    em->npartitions = npartitions;
+    em->partitions = calloc(npartitions, sizeof(*em->partitions));
+    em->store_w = extmem_file(dir, "charm.store", &em->store_r);
+    em->index = extmem_file(dir, "charm.index", NULL);
+    em->edges = extmem_file(dir, "charm.edges", NULL);
+    if (em->store_w == NULL || em->index == NULL || em->edges == NULL) {
+        return NULL;
+    }
+    for (unsigned int i = 0; i < npartitions; i++) {
+        struct extmem_partition *p = &em->partitions[i];
+        char name[64];
+        mutex_init(&p->lock);
+        sprintf(name, "charm.cand%u", i);
+        p->candidates = extmem_file(dir, name, NULL);
+        sprintf(name, "charm.visited%u", i);
+        p->visited = extmem_file(dir, name, NULL);
+        if (p->candidates == NULL || p->visited == NULL) {
+            return NULL;
+        }
+    }
+    em->buf = malloc(EXTMEM_BUFSIZE);
+    return em;
+}
+
+static void extmem_write(FILE *f, const void *p, size_t size){
+    if (size > 0 && fwrite(p, size, 1, f) != 1) {
+        perror("charm: external memory");
+        exit(1);
+    }
+}
+
+// Read the next record.  The edge and the state end up in em->buf.
+static bool extmem_read(struct extmem *em, FILE *f, struct extmem_record *rec){
+    if (fread(rec, sizeof(*rec), 1, f) != 1) {
+        return false;
+    }
+    size_t size = rec->esize + rec->ssize;
+    assert(size <= EXTMEM_BUFSIZE);
+    if (fread(em->buf, size, 1, f) != 1) {
+        panic("extmem_read: truncated file");
+    }
+    return true;
+}
+
+// Add a state to the store, with the edge from its parent
+static void extmem_store(struct extmem *em, struct extmem_record *rec,
+                                        const void *edge, const void *state){
+    extmem_write(em->index, &em->store_size, sizeof(em->store_size));
+    extmem_write(em->store_w, rec, sizeof(*rec));
+    if (edge != NULL) {             // only the initial state has no edge
+        extmem_write(em->store_w, edge, rec->esize);
+    }
+    extmem_write(em->store_w, state, rec->ssize);
+    em->store_size += sizeof(*rec) + rec->esize + rec->ssize;
+}
+
+static void extmem_visited(struct extmem *em, struct extmem_partition *p,
+                                        uint32_t id, const void *state, unsigned int ssize){
+    struct extmem_record rec = { id, EXTMEM_NONE, 0, 0, ssize };
+    extmem_write(p->visited, &rec, sizeof(rec));
+    extmem_write(p->visited, state, ssize);
+    p->nvisited++;
+}
+
+// Add the initial state, which becomes the first layer
+void extmem_root(struct extmem *em, struct state *state){
+    assert(em->nstates == 0);
+    unsigned int size = state_size(state);
+    struct extmem_record rec = { 0, EXTMEM_NONE, 0, 0, size };
+    extmem_store(em, &rec, NULL, state);
+    struct extmem_partition *p = &em->partitions[(state_hash(state) >> 32) % em->npartitions];
+    extmem_visited(em, p, 0, state, size);
+    em->nstates = 1;
+    em->next = 0;
+    em->layer_end = 1;
+    fflush(em->store_w);
+    fseeko(em->store_r, 0, SEEK_SET);
+}
+
+// Remember a successor of state src, to be checked against the visited
+// states at the end of the layer.  Thread-safe.
+void extmem_candidate(struct extmem *em, struct node *src, struct edge *edge,
+                                            struct state *state, uint64_t hash){
+    unsigned int esize = sizeof(struct edge) + edge->nlog * sizeof(hvalue_t);
+    unsigned int ssize = state_size(state);
+    struct extmem_record rec = {
+        0, src->id, src->steps + edge->nsteps, esize, ssize
+    };
+    struct extmem_partition *p = &em->partitions[(hash >> 32) % em->npartitions];
+    mutex_acquire(&p->lock);
+    extmem_write(p->candidates, &rec, sizeof(rec));
+    extmem_write(p->candidates, edge, esize);
+    extmem_write(p->candidates, state, ssize);
+    p->ncandidates++;
+    mutex_release(&p->lock);
+}
+
+// Load up to max states of the current layer into em->chunk, freeing
+// the states that were loaded before.  Returns the number of states.
+unsigned int extmem_load(struct extmem *em, unsigned int max){
+    for (unsigned int i = 0; i < em->chunk_size; i++) {
+        free(em->chunk[i]);
+    }
+    em->chunk = realloc(em->chunk, max * sizeof(*em->chunk));
+    em->chunk_size = 0;
+    while (em->chunk_size < max && em->next < em->layer_end) {
+        struct extmem_record rec;
+        if (!extmem_read(em, em->store_r, &rec)) {
+            panic("extmem_load: truncated store");
+        }
+        assert(rec.id == em->next);
+        struct node *node = calloc(1, sizeof(struct node) + rec.ssize);
+        node->state = (struct state *) &node[1];
+        memcpy(node->state, em->buf + rec.esize, rec.ssize);
+        node->id = rec.id;
+        node->len = em->layer;
+        node->steps = rec.steps;
+        node->initialized = true;
+        em->chunk[em->chunk_size++] = node;
+        em->next++;
+    }
+    return em->chunk_size;
+}
+
+// Check the candidates of one partition against its visited states.  New
+// states are numbered, stored, and become part of the next layer.
+static void extmem_dedup(struct extmem *em, struct extmem_partition *p){
+    struct dict *dict = dict_new("extmem", sizeof(uint32_t),
+                    p->nvisited + p->ncandidates, 0, false);
+    struct extmem_record rec;
+
+    rewind(p->visited);
+    for (unsigned long i = 0; i < p->nvisited; i++) {
+        if (!extmem_read(em, p->visited, &rec)) {
+            panic("extmem_dedup: truncated visited file");
+        }
+        bool new;
+        uint32_t *id = dict_insert(dict, NULL, em->buf, rec.ssize, &new);
+        assert(new);
+        *id = rec.id;
+    }
+    fseeko(p->visited, 0, SEEK_END);
+
+    rewind(p->candidates);
+    for (unsigned long i = 0; i < p->ncandidates; i++) {
+        if (!extmem_read(em, p->candidates, &rec)) {
+            panic("extmem_dedup: truncated candidates file");
+        }
+        const char *state = em->buf + rec.esize;
+        bool new;
+        uint32_t *id = dict_insert(dict, NULL, state, rec.ssize, &new);
+        if (new) {
+            *id = rec.id = em->nstates++;
+            extmem_store(em, &rec, em->buf, state);
+            extmem_visited(em, p, rec.id, state, rec.ssize);
+        }
+        if (*id != rec.parent) {
+            uint32_t pair[2] = { rec.parent, *id };
+            extmem_write(em->edges, pair, sizeof(pair));
+            em->nedges++;
+        }
+    }
+    rewind(p->candidates);
+    p->ncandidates = 0;
+
+    dict_delete(dict);
+}
+
+// Called when all states of the current layer have been expanded.
+// Returns false if the next layer is empty.
+bool extmem_next_layer(struct extmem *em){
+    assert(em->next == em->layer_end);
+    uint64_t offset = em->store_size;
+    uint32_t first = em->nstates;
+    for (unsigned int i = 0; i < em->npartitions; i++) {
+        struct extmem_partition *p = &em->partitions[i];
+        fflush(p->candidates);
+        fflush(p->visited);
+        extmem_dedup(em, p);
+    }
+    fflush(em->store_w);
+    fseeko(em->store_r, offset, SEEK_SET);
+    em->next = first;
+    em->layer_end = em->nstates;
+    em->layer++;
+    return em->next < em->layer_end;
+}
+
+// Read a state and the path to it back from the store.  The nodes and
+// edges on the path are allocated, except for the initial state, which
+// is root.  Only used after the search.
+struct node *extmem_path(struct extmem *em, uint32_t id, struct node *root){
+    fflush(em->store_w);
+    fflush(em->index);
+
+    // Read the states on the path, starting from the last one
+    struct node *list = NULL;
+    while (id != 0) {
+        uint64_t offset;
+        struct extmem_record rec;
+        fseeko(em->index, (uint64_t) id * sizeof(offset), SEEK_SET);
+        if (fread(&offset, sizeof(offset), 1, em->index) != 1) {
+            panic("extmem_path: bad index");
+        }
+        fseeko(em->store_r, offset, SEEK_SET);
+        if (!extmem_read(em, em->store_r, &rec)) {
+            panic("extmem_path: truncated store");
+        }
+        assert(rec.id == id);
+        struct node *node = calloc(1, sizeof(struct node) + rec.ssize);
+        node->state = (struct state *) &node[1];
+        memcpy(node->state, em->buf + rec.esize, rec.ssize);
+        node->id = id;
+        node->initialized = true;
+        struct edge *edge = malloc(rec.esize);
+        memcpy(edge, em->buf, rec.esize);
+        edge->fwdnext = edge->bwdnext = NULL;
+        edge->ai = NULL;
+        edge->dst = node;
+        node->to_parent = edge;
+        node->next = list;
+        list = node;
+        id = rec.parent;
+    }
+    fseeko(em->index, 0, SEEK_END);
+
+    // Connect them, starting from the initial state
+    struct node *parent = root;
+    for (struct node *node = list; node != NULL; node = node->next) {
+        node->to_parent->src = parent;
+        node->len = parent->len + 1;
+        node->steps = parent->steps + node->to_parent->nsteps;
+        parent = node;
+    }
+    return parent;
+}
+
+// Compute the strongly connected components of the logged edges with
+// Tarjan's algorithm, iteratively and with the edges in compressed sparse
+// row format.  Returns the component of each state.  A component is good
+// if it has an edge to another component.
+uint32_t *extmem_components(struct extmem *em, uint32_t *pncomponents, bool **pgood){
+    uint32_t n = em->nstates;
+    uint32_t pair[2];
+
+    // Read the edges into CSR format
+    uint64_t *first = calloc((uint64_t) n + 1, sizeof(*first));
+    uint32_t *targets = malloc((em->nedges + 1) * sizeof(*targets));
+    fflush(em->edges);
+    rewind(em->edges);
+    while (fread(pair, sizeof(pair), 1, em->edges) == 1) {
+        first[pair[0] + 1]++;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        first[i + 1] += first[i];
+    }
+    uint64_t *fill = malloc((uint64_t) n * sizeof(*fill));
+    memcpy(fill, first, (uint64_t) n * sizeof(*fill));
+    rewind(em->edges);
+    while (fread(pair, sizeof(pair), 1, em->edges) == 1) {
+        targets[fill[pair[0]]++] = pair[1];
+    }
+    fseeko(em->edges, 0, SEEK_END);
+
+    // Tarjan's algorithm.  The call stack keeps the position in the list
+    // of edges of each state (in fill, which is no longer needed).
+    uint32_t *index = calloc(n, sizeof(*index));    // 0 means not visited
+    uint32_t *low = malloc(n * sizeof(*low));
+    uint32_t *comp = malloc(n * sizeof(*comp));
+    uint32_t *stack = malloc(n * sizeof(*stack));
+    uint32_t *calls = malloc(n * sizeof(*calls));
+    uint32_t nindex = 0, sp = 0, ncalls = 0, ncomponents = 0;
+    for (uint32_t root = 0; root < n; root++) {
+        if (index[root] != 0) {
+            continue;
+        }
+        index[root] = low[root] = ++nindex;
+        comp[root] = EXTMEM_NONE;
+        stack[sp++] = root;
+        fill[root] = first[root];
+        calls[ncalls++] = root;
+        while (ncalls > 0) {
+            uint32_t v = calls[ncalls - 1];
+            if (fill[v] < first[v + 1]) {
+                uint32_t w = targets[fill[v]++];
+                if (index[w] == 0) {
+                    index[w] = low[w] = ++nindex;
+                    comp[w] = EXTMEM_NONE;
+                    stack[sp++] = w;
+                    fill[w] = first[w];
+                    calls[ncalls++] = w;
+                }
+                else if (comp[w] == EXTMEM_NONE && index[w] < low[v]) {
+                    low[v] = index[w];      // w is on the stack
+                }
+                continue;
+            }
+            ncalls--;
+            if (low[v] == index[v]) {
+                uint32_t w;
+                do {
+                    w = stack[--sp];
+                    comp[w] = ncomponents;
+                } while (w != v);
+                ncomponents++;
+            }
+            if (ncalls > 0) {
+                uint32_t u = calls[ncalls - 1];
+                if (low[v] < low[u]) {
+                    low[u] = low[v];
+                }
+            }
+        }
+    }
+    free(index);
+    free(low);
+    free(stack);
+    free(calls);
+    free(fill);
+
+    bool *good = calloc(ncomponents, sizeof(*good));
+    for (uint32_t v = 0; v < n; v++) {
+        for (uint64_t e = first[v]; e < first[v + 1]; e++) {
+            if (comp[targets[e]] != comp[v]) {
+                good[comp[v]] = true;
+                break;
+            }
+        }
+    }
+    free(first);
+    free(targets);
+
+    *pncomponents = ncomponents;
+    *pgood = good;
+    return comp;
+}
+
+// Go back to the first state in the store (see extmem_scan())
+void extmem_rewind(struct extmem *em){
+    fflush(em->store_w);
+    fseeko(em->store_r, 0, SEEK_SET);
+}
+
+// Read the next state from the store, or return NULL after the last one.
+// The state is overwritten by the next call.
+struct state *extmem_scan(struct extmem *em, uint32_t *pid){
+    struct extmem_record rec;
+    if (!extmem_read(em, em->store_r, &rec)) {
+        return NULL;
+    }
+    *pid = rec.id;
+    return (struct state *) (em->buf + rec.esize);
+}
@@ -0,0 +1,70 @@
+#ifndef SRC_EXTMEM_H
+#define SRC_EXTMEM_H
+
+// External-memory search (charm -e).  The states are kept on disk rather
+// than in the graph, and duplicates are detected once per layer rather
+// than when a state is found (delayed duplicate detection).  The visited
+// states are split into partitions by hash, and only one partition needs
+// to be in memory at a time.  The edges between different states are
+// logged to disk as well, so that strongly connected components can be
+// computed afterwards with a few words of memory per state.
+//
+// States are numbered in the order in which they are first found, which
+// is breadth-first.  The store holds all states in this order, each with
+// the identifier of its parent and the edge from its parent, so that a
+// path to the initial state can be read back.  All files are scratch files
+// in the given directory, removed when the model checker exits.
+//
+// Only the states go to disk.  The values they refer to (contexts, sets,
+// dictionaries, and so on) are still kept in the value tables in memory,
+// as are the failures found and, while a layer is being deduplicated, a
+// hash table of the visited states of one partition.  So the search can
+// still run out of memory on models with many distinct values.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "thread.h"
+
+struct state;
+struct edge;
+struct node;
+
+#define EXTMEM_NONE     ((uint32_t) -1)
+
+struct extmem_partition {
+    mutex_t lock;               // protects candidates
+    FILE *candidates;           // successors found in the current layer
+    FILE *visited;              // states in this partition
+    unsigned long ncandidates;  // #records in candidates
+    unsigned long nvisited;     // #records in visited
+};
+
+struct extmem {
+    unsigned int npartitions;
+    struct extmem_partition *partitions;
+    FILE *store_w, *store_r;    // all states, writing and reading
+    FILE *index;                // offset of each state in the store
+    FILE *edges;                // pairs of state identifiers
+    uint64_t store_size;        // #bytes in the store
+    uint32_t nstates;           // #states found so far
+    uint64_t nedges;            // #edges logged
+    unsigned int layer;         // current layer
+    uint32_t next, layer_end;   // states of the current layer still to load
+    struct node **chunk;        // states loaded from the current layer
+    unsigned int chunk_size;    // #states in chunk
+    char *buf;                  // for reading records
+};
+
+struct extmem *extmem_new(const char *dir, unsigned int npartitions);
+void extmem_root(struct extmem *em, struct state *state);
+void extmem_candidate(struct extmem *em, struct node *src, struct edge *edge,
+                                            struct state *state, uint64_t hash);
+unsigned int extmem_load(struct extmem *em, unsigned int max);
+bool extmem_next_layer(struct extmem *em);
+struct node *extmem_path(struct extmem *em, uint32_t id, struct node *root);
+uint32_t *extmem_components(struct extmem *em, uint32_t *pncomponents, bool **pgood);
+void extmem_rewind(struct extmem *em);
+struct state *extmem_scan(struct extmem *em, uint32_t *pid);
+
+#endif //SRC_EXTMEM_H
@@ -10,6 +10,7 @@
 #include "ops.h"
 #include "charm.h"
 #include "graph.h"
+#include "csr.h"
 #endif
 
 #define new_alloc(t)	(t *) calloc(1, sizeof(t))
@@ -19,6 +20,7 @@ void graph_init(struct graph *graph, unsigned int initial_size) {
     graph->size = 0;
     graph->alloc_size = initial_size;
     graph->nodes = malloc(graph->alloc_size * sizeof(struct node *));
+    graph->csr = NULL;
 }
 
 void graph_add(struct graph *graph, struct node *node) {
@@ -40,7 +42,17 @@ unsigned int graph_add_multiple(struct graph *graph, unsigned int n) {
     return node_id;
 }
 
+// Swap the states at positions x and y (see graph_pos())
 static void inline swap(struct graph *graph, unsigned int x, unsigned int y){
+    struct csr *csr = graph->csr;
+    if (csr != NULL) {
+        uint32_t nx = csr->perm[x], ny = csr->perm[y];
+        csr->perm[x] = ny;
+        csr->pos[ny] = x;
+        csr->perm[y] = nx;
+        csr->pos[nx] = y;
+        return;
+    }
     struct node *tmp = graph->nodes[x];
     graph->nodes[x] = graph->nodes[y];
     graph->nodes[y] = tmp;
@@ -74,34 +86,41 @@ struct scc *scc_alloc(unsigned int start, unsigned int finish, struct scc *next,
 // connected component holding node scc->start, the remaining successors of the node, the remaining
 // nodes minus the predecessors and the successors, and finally the predecessors minus the nodes
 // in the strongly connected component.  Then iteratively visit the last three partitions.
+// The range is one of positions, which with the compressed graph differ from node identifiers.
 struct scc *graph_find_scc_one(struct graph *graph, struct scc *scc, unsigned int component, void **scc_cache) {
     unsigned int start = scc->start;
     unsigned int finish = scc->finish;
     assert(start < finish);
     struct scc *next_scc = scc->next;
+    struct graph_iter it;
+    uint32_t next;
 
     // Optimization. See if this node has either no incoming or
-    // no outgoing edges.  If so, it's a component in its own right
+    // no outgoing edges within the range.  If so, it's a component
+    // in its own right
     bool optim = true;
-    struct node *node = graph->nodes[start];
-    for (struct edge *e = node->fwd; e != NULL; e = e->fwdnext) {
-        struct node *next = e->dst;
-        if (next->id >= start && next->id < finish) {
+    uint32_t id = graph_at(graph, start);
+    graph_succ(graph, id, &it);
+    while (graph_next(&it, &next)) {
+        uint32_t p = graph_pos(graph, next);
+        if (p >= start && p < finish) {
             optim = false;
             break;
         }
     }
     if (!optim) {
         optim = true;
-        for (struct edge *e = node->bwd; e != NULL; e = e->bwdnext) {
-            struct node *next = e->dst;
-            if (next->id >= start && next->id < finish) {
+        graph_pred(graph, id, &it);
+        while (graph_next(&it, &next)) {
+            uint32_t p = graph_pos(graph, next);
+            if (p >= start && p < finish) {
                 optim = false;
+                break;
             }
         }
     }
     if (optim) {
-        node->component = component;
+        graph_set_component(graph, id, component);
         scc->start++;
         if (scc->start < scc->finish) {
             return scc;
@@ -120,22 +139,22 @@ struct scc *graph_find_scc_one(struct graph *graph, struct scc *scc, unsigned in
         swap(graph, start, (finish + start) / 2);
     }
 
-    graph->nodes[start]->component = component;
+    graph_set_component(graph, graph_at(graph, start), component);
 
     // Phase 1: move all successors of nodes[0] to the bottom
     unsigned int lo = start + 1;
     for (unsigned int i = start; i < lo; i++) {
-        struct node *node = graph->nodes[i];
-        for (struct edge *e = node->fwd; e != NULL; e = e->fwdnext) {
-            struct node *next = e->dst;
-            if (next->id < start || next->id >= finish) {
+        graph_succ(graph, graph_at(graph, i), &it);
+        while (graph_next(&it, &next)) {
+            uint32_t p = graph_pos(graph, next);
+            if (p < start || p >= finish) {
                 continue;
             }
-            if (next->id < lo) {
+            if (p < lo) {
                 continue;
             }
-            if (next->id > lo) {
-                swap(graph, lo, next->id);
+            if (p > lo) {
+                swap(graph, lo, p);
             }
             lo++;
             assert(lo <= finish);
@@ -148,26 +167,26 @@ struct scc *graph_find_scc_one(struct graph *graph, struct scc *scc, unsigned in
     // Phase 2: move all precedessors
     for (unsigned int i = start, j = hi; i < mid || j > hi;) {
         bool in_scc = i < mid;
-        struct node *node = in_scc ? graph->nodes[i] : graph->nodes[j];
-        for (struct edge *e = node->bwd; e != NULL; e = e->bwdnext) {
-            struct node *next = e->src;
-            if (next->id < start || next->id >= finish) {
+        graph_pred(graph, graph_at(graph, in_scc ? i : j), &it);
+        while (graph_next(&it, &next)) {
+            uint32_t p = graph_pos(graph, next);
+            if (p < start || p >= finish) {
                 continue;
             }
-            if (next->id < lo) {        // in SCC
-                if (next->id >= mid) {
-                    next->component = component;
-                    if (next->id > mid) {
-                        swap(graph, mid, next->id);
+            if (p < lo) {        // in SCC
+                if (p >= mid) {
+                    graph_set_component(graph, next, component);
+                    if (p > mid) {
+                        swap(graph, mid, p);
                     }
                     mid++;
                     assert(mid <= lo);
                 }
             }
             else {
-                if (next->id <= hi) {
-                    if (next->id < hi) {
-                        swap(graph, hi, next->id);
+                if (p <= hi) {
+                    if (p < hi) {
+                        swap(graph, hi, p);
                     }
                     hi--;
                     assert(hi >= start);
@@ -229,6 +248,57 @@ bool graph_edge_conflict(
     return false;
 }
 
+void graph_access_sig(struct edge *edge, struct access_sig *sig){
+    sig->any = sig->stores = sig->plain = 0;
+    sig->self = false;
+    for (struct access_info *ai = edge->ai; ai != NULL; ai = ai->next) {
+        if (ai->indices != NULL) {
+            assert(ai->n > 0);
+            uint64_t bit = (uint64_t) 1 << ((ai->indices[0] * 0x9E3779B97F4A7C15ULL) >> 58);
+            sig->any |= bit;
+            if (!ai->load) {
+                sig->stores |= bit;
+            }
+            if (!ai->atomic) {
+                sig->plain |= bit;
+                if (!ai->load && edge->multiplicity > 1) {
+                    sig->self = true;
+                }
+            }
+        }
+    }
+}
+
+// Two edges can only conflict if they access the same variable, at least
+// one of them stores it, and at least one of them not atomically
+static inline bool access_sig_overlap(struct access_sig *s1, struct access_sig *s2){
+    return (((s1->stores & s2->any) | (s1->any & s2->stores)) &
+                ((s1->plain & s2->any) | (s1->any & s2->plain))) != 0;
+}
+
+// See if graph_check_for_data_race() would report anything for a state
+// with the given outgoing edges.  sigs must have room for n signatures.
+bool graph_has_data_race(struct edge **edges, unsigned int n, struct access_sig *sigs){
+    for (unsigned int i = 0; i < n; i++) {
+        graph_access_sig(edges[i], &sigs[i]);
+        if (sigs[i].self) {
+            return true;
+        }
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        if (sigs[i].any == 0) {
+            continue;
+        }
+        for (unsigned int j = i + 1; j < n; j++) {
+            if (access_sig_overlap(&sigs[i], &sigs[j]) &&
+                    graph_edge_conflict(NULL, NULL, NULL, edges[i], edges[j])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 void graph_check_for_data_race(
     struct node *node,
     struct minheap *warnings,
@@ -7,6 +7,8 @@
 #include "thread.h"
 #include "hashtab.h"
 
+struct csr;
+
 struct component {
     bool good;              // terminating or out-going edge
     unsigned int size;      // #states
@@ -73,7 +75,6 @@ struct node {
     bool initialized : 1;   // this node structure has been initialized
     bool failed : 1;        // a thread has failed
     bool final : 1;         // only eternal threads left (TODO: need this?)
-    bool visited : 1;       // for busy wait detection
 
     // NFA compression
     bool reachable : 1;
@@ -86,10 +87,22 @@ struct failure {
     hvalue_t address;       // in case of data race or invariant failure
 };
 
+// Summary of the shared variable accesses of an edge, used to rule out
+// most pairs of edges before their addresses are compared.  Each access
+// sets the bit selected by the first index of its address, on which two
+// conflicting addresses (one a prefix of the other) must agree.
+struct access_sig {
+    uint64_t any;           // all accesses
+    uint64_t stores;        // stores and deletes
+    uint64_t plain;         // non-atomic accesses
+    bool self;              // edge conflicts with itself
+};
+
 struct graph {
     struct node **nodes;         // vector of all nodes
     unsigned int size;           // to create node identifiers
     unsigned int alloc_size;     // size allocated
+    struct csr *csr;             // compressed form (see csr.h), or NULL
 };
 
 void graph_init(struct graph *graph, unsigned int initial_size);
@@ -106,6 +119,8 @@ void graph_check_for_data_race(
     struct minheap *warnings,
     struct engine *engine
 );
+void graph_access_sig(struct edge *edge, struct access_sig *sig);
+bool graph_has_data_race(struct edge **edges, unsigned int n, struct access_sig *sigs);
 void graph_add(struct graph *graph, struct node *node);
 unsigned int graph_add_multiple(struct graph *graph, unsigned int n);
 unsigned int graph_find_scc(struct graph *graph);
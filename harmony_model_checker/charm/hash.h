@@ -0,0 +1,141 @@
+#ifndef SRC_HASH_H
+#define SRC_HASH_H
+
+// Hash functions for the hash tables.
+//
+// meiyan is a fast 32-bit hash, and what the chained tables use by default.
+// hash64 is a 64-bit hash used by open addressing, and by all tables if
+// USE_HASH64 is defined (see head.h).  Long keys are processed 32 bytes at
+// a time in four independent 64-bit lanes, which maps onto AVX2 or SSE2
+// registers if the compiler targets them (e.g., -mavx2 or -march=native).
+// All versions compute the same hash.  The rest of the key is mixed in 16
+// bytes at a time with a 64x64->128 bit multiply.
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+static inline uint32_t meiyan(const char *key, int count) {
+	typedef uint32_t *P;
+	uint32_t h = 0x811c9dc5;
+	while (count >= 8) {
+		h = (h ^ ((((*(P)key) << 5) | ((*(P)key) >> 27)) ^ *(P)(key + 4))) * 0xad3e7;
+		count -= 8;
+		key += 8;
+	}
+	#define tmp h = (h ^ *(uint16_t*)key) * 0xad3e7; key += 2;
+	if (count & 4) { tmp tmp }
+	if (count & 2) { tmp }
+	if (count & 1) { h = (h ^ *key) * 0xad3e7; }
+	#undef tmp
+	return h ^ (h >> 16);
+}
+
+#define HASH_P1     0x9e3779b97f4a7c15ULL
+#define HASH_P2     0xc2b2ae3d27d4eb4fULL
+#define HASH_P3     0x165667b19e3779f9ULL
+#define HASH_P4     0x27d4eb2f165667c5ULL
+
+// Multiply to 128 bits and fold the halves (as in wyhash)
+static inline uint64_t hash_mum(uint64_t a, uint64_t b){
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t) a, lb = (uint32_t) b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    return lo ^ (rh + (rm0 >> 32) + (rm1 >> 32) + c);
+#endif
+}
+
+// Process the 32-byte stripes of the key.  In each lane, the product of
+// the two halves of (word ^ secret) is added to the accumulator, along
+// with the word of the neighboring lane.
+static inline void hash_stripes(uint64_t acc[4], const char *key, unsigned int nstripes){
+#if defined(__AVX2__)
+    __m256i a = _mm256_loadu_si256((const __m256i *) acc);
+    const __m256i secret = _mm256_set_epi64x(HASH_P4, HASH_P3, HASH_P2, HASH_P1);
+    for (unsigned int i = 0; i < nstripes; i++, key += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *) key);
+        __m256i k = _mm256_xor_si256(d, secret);
+        __m256i product = _mm256_mul_epu32(k, _mm256_srli_epi64(k, 32));
+        __m256i swapped = _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+        a = _mm256_add_epi64(a, _mm256_add_epi64(product, swapped));
+    }
+    _mm256_storeu_si256((__m256i *) acc, a);
+#elif defined(__SSE2__)
+    __m128i a0 = _mm_loadu_si128((const __m128i *) acc);
+    __m128i a1 = _mm_loadu_si128((const __m128i *) &acc[2]);
+    const __m128i s0 = _mm_set_epi64x(HASH_P2, HASH_P1);
+    const __m128i s1 = _mm_set_epi64x(HASH_P4, HASH_P3);
+    for (unsigned int i = 0; i < nstripes; i++, key += 32) {
+        __m128i d0 = _mm_loadu_si128((const __m128i *) key);
+        __m128i d1 = _mm_loadu_si128((const __m128i *) (key + 16));
+        __m128i k0 = _mm_xor_si128(d0, s0);
+        __m128i k1 = _mm_xor_si128(d1, s1);
+        a0 = _mm_add_epi64(a0, _mm_add_epi64(_mm_mul_epu32(k0, _mm_srli_epi64(k0, 32)),
+                            _mm_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+        a1 = _mm_add_epi64(a1, _mm_add_epi64(_mm_mul_epu32(k1, _mm_srli_epi64(k1, 32)),
+                            _mm_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+    _mm_storeu_si128((__m128i *) acc, a0);
+    _mm_storeu_si128((__m128i *) &acc[2], a1);
+#else
+    static const uint64_t secret[4] = { HASH_P1, HASH_P2, HASH_P3, HASH_P4 };
+    for (unsigned int i = 0; i < nstripes; i++, key += 32) {
+        uint64_t d[4];
+        memcpy(d, key, 32);
+        for (unsigned int j = 0; j < 4; j++) {
+            uint64_t k = d[j] ^ secret[j];
+            acc[j] += (k & 0xffffffff) * (k >> 32) + d[j ^ 1];
+        }
+    }
+#endif
+}
+
+static inline uint64_t hash64(const char *key, unsigned int count){
+    uint64_t h = HASH_P1 ^ count, a = 0, b = 0;
+    unsigned int len = count;
+    if (count >= 32) {
+        uint64_t acc[4] = { HASH_P3, HASH_P4, HASH_P2, HASH_P1 };
+        hash_stripes(acc, key, count / 32);
+        key += count & ~31U;
+        count &= 31;
+        h = hash_mum(acc[0] ^ HASH_P2, acc[1] ^ h);
+        h = hash_mum(acc[2] ^ HASH_P3, acc[3] ^ h);
+    }
+    while (count >= 16) {
+        memcpy(&a, key, 8);
+        memcpy(&b, key + 8, 8);
+        h = hash_mum(a ^ HASH_P2, b ^ h);
+        count -= 16;
+        key += 16;
+    }
+    a = b = 0;
+    if (count > 8) {
+        memcpy(&a, key, 8);
+        memcpy(&b, key + 8, count - 8);
+    }
+    else {
+        memcpy(&a, key, count);
+    }
+    return hash_mum(HASH_P4 ^ len, hash_mum(a ^ HASH_P2, b ^ h ^ HASH_P3));
+}
+
+// 32-bit hash for the chained tables
+static inline uint32_t hash32(const char *key, unsigned int count){
+#ifdef USE_HASH64
+    uint64_t h = hash64(key, count);
+    return (uint32_t) (h ^ (h >> 32));
+#else
+    return meiyan(key, count);
+#endif
+}
+
+#endif // SRC_HASH_H
@@ -3,28 +3,35 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+#ifdef USE_ATOMIC
+#include <stdatomic.h>
+#include <sched.h>
+#endif
 
 #include "global.h"
 #include "hashdict.h"
+#include "hash.h"
 #include "thread.h"
 
-#define hash_func meiyan
+#define hash_func hash32
 
-static inline uint32_t meiyan(const char *key, int count) {
-	typedef uint32_t *P;
-	uint32_t h = 0x811c9dc5;
-	while (count >= 8) {
-		h = (h ^ ((((*(P)key) << 5) | ((*(P)key) >> 27)) ^ *(P)(key + 4))) * 0xad3e7;
-		count -= 8;
-		key += 8;
-	}
-	#define tmp h = (h ^ *(uint16_t*)key) * 0xad3e7; key += 2;
-	if (count & 4) { tmp tmp }
-	if (count & 2) { tmp }
-	if (count & 1) { h = (h ^ *key) * 0xad3e7; }
-	#undef tmp
-	return h ^ (h >> 16);
-}
+// In async mode, #entries a worker adds between checks for growth
+#define GROW_CHECK      1024
+
+// Incremental growth.  While a table is being migrated, every
+// MIGRATE_EVERY finds a worker migrates the next MIGRATE_STEP buckets
+// of the old table.  The head of a migrated bucket is set to DICT_MOVED.
+#define MIGRATE_EVERY   16
+#define MIGRATE_STEP    16
+#define DICT_MOVED      ((struct dict_assoc *) 1)
+
+// Open addressing
+#define OPEN_SEALED     ((uint64_t) 2)  // hash of sealed empty slot (others are odd)
+#define OPEN_PROBES     128             // max #slots to probe in a table
+#define OPEN_GROWTH     4               // growth factor of open tables
+#define OPEN_LOAD       0.75            // max load before a table is sealed
 
 static inline struct dict_assoc *dict_assoc_new(struct dict *dict,
         struct allocator *al, char *key, unsigned int len, uint32_t hash){
@@ -33,6 +40,7 @@ static inline struct dict_assoc *dict_assoc_new(struct dict *dict,
                         (*al->alloc)(al->ctx, total, false, dict->align16);
     memset(k, 0, sizeof(*k) + dict->value_len);
 	k->len = len;
+    k->hash = hash;
 	memcpy((char *) &k[1] + dict->value_len, key, len);
 	return k;
 }
@@ -44,16 +52,26 @@ void dict_assoc_delete(struct dict *dict, struct dict_assoc *node) {
 	free(node);
 }
 
+// Table lengths are kept a multiple of the number of locks, so an entry
+// is protected by the same lock (hash % nlocks) in the old and the new
+// table while the table is being migrated.
+static unsigned int dict_round_length(struct dict *dict, unsigned int length){
+    if (dict->nlocks > 0 && length % dict->nlocks != 0) {
+        length += dict->nlocks - length % dict->nlocks;
+    }
+    return length;
+}
+
 struct dict *dict_new(char *whoami, unsigned int value_len, unsigned int initial_size,
         unsigned int nworkers, bool align16) {
 	struct dict *dict = new_alloc(struct dict);
     dict->whoami = whoami;
     dict->value_len = value_len;
-	if (initial_size == 0) initial_size = 1024;
-	dict->length = dict->old_length = initial_size;
-	dict->count = dict->old_count = 0;
-	dict->table = dict->old_table = calloc(sizeof(struct dict_bucket), initial_size);
     dict->nlocks = nworkers * 64;        // TODO: how much?
+	if (initial_size == 0) initial_size = 1024;
+	dict->length = dict_round_length(dict, initial_size);
+	dict->count = 0;
+	dict->table = calloc(sizeof(struct dict_bucket), dict->length);
     dict->locks = malloc(dict->nlocks * sizeof(mutex_t));
 	for (unsigned int i = 0; i < dict->nlocks; i++) {
 		mutex_init(&dict->locks[i]);
@@ -61,6 +79,7 @@ struct dict *dict_new(char *whoami, unsigned int value_len, unsigned int initial
 	dict->growth_threshold = 2;
 	dict->growth_factor = 10;
 	dict->concurrent = false;
+    mutex_init(&dict->grow_lock);
     dict->workers = calloc(sizeof(struct dict_worker), nworkers);
     dict->nworkers = nworkers;
     for (unsigned int i = 0; i < nworkers; i++) {
@@ -75,13 +94,64 @@ bool dict_remove(struct dict *dict, const void *key, unsigned int keylen){
     return false;
 }
 
+static void odict_free(struct dict_open *t){
+    while (t != NULL) {
+        struct dict_open *next = t->next;
+        free(t->slots);
+        free(t);
+        t = next;
+    }
+}
+
+// Free the tables that are no longer in use.  Only to be called when
+// no other worker can be looking at them.
+static void odict_prune(struct dict *dict){
+    odict_free(dict->open_old);
+    dict->open_old = NULL;
+    while (dict->open->migrated) {
+        struct dict_open *t = dict->open;
+        dict->open = t->next;
+        t->next = NULL;
+        odict_free(t);
+    }
+    assert(dict->open->next == NULL);
+}
+
 void dict_delete(struct dict *dict) {
+    if (dict->ht != NULL) {
+        ht_delete(dict->ht);
+    }
+    if (dict->open != NULL) {
+        for (struct dict_open *t = dict->open; t != NULL; t = t->next) {
+            if (t->migrated) {
+                continue;           // entries are in the next table
+            }
+            for (unsigned int i = 0; i < t->length; i++) {
+                if (t->slots[i].assoc != NULL) {
+                    free(t->slots[i].assoc);
+                }
+            }
+        }
+        odict_free(dict->open);
+        odict_free(dict->open_old);
+    }
 	for (unsigned int i = 0; i < dict->length; i++) {
 		if (dict->table[i].stable != NULL)
 			dict_assoc_delete(dict, dict->table[i].stable);
 		if (dict->table[i].unstable != NULL)
 			dict_assoc_delete(dict, dict->table[i].unstable);
 	}
+    if (dict->old_table != NULL) {
+        for (unsigned int i = 0; i < dict->old_length; i++) {
+            if (dict->old_table[i].stable != DICT_MOVED) {
+                if (dict->old_table[i].stable != NULL)
+                    dict_assoc_delete(dict, dict->old_table[i].stable);
+                if (dict->old_table[i].unstable != NULL)
+                    dict_assoc_delete(dict, dict->old_table[i].unstable);
+            }
+        }
+        free(dict->old_table);
+    }
 	for (unsigned int i = 0; i < dict->nlocks; i++) {
 		mutex_destroy(&dict->locks[i]);
     }
@@ -90,17 +160,35 @@ void dict_delete(struct dict *dict) {
 }
 
 static inline void dict_reinsert_when_resizing(struct dict *dict, struct dict_assoc *k) {
-    unsigned int n = hash_func((char *) &k[1] + dict->value_len, k->len) % dict->length;
+    unsigned int n = k->hash % dict->length;
 	struct dict_bucket *db = &dict->table[n];
     k->next = db->stable;
     db->stable = k;
 }
 
 unsigned long dict_allocated(struct dict *dict) {
-    return dict->length * sizeof(struct dict_bucket);
+    if (dict->ht != NULL) {
+        return ht_allocated(dict->ht);
+    }
+    if (dict->open != NULL) {
+        unsigned long total = 0;
+        for (struct dict_open *t = dict->open; t != NULL; t = t->next) {
+            total += t->length * sizeof(struct dict_slot);
+        }
+        for (struct dict_open *t = dict->open_old; t != NULL; t = t->next) {
+            total += t->length * sizeof(struct dict_slot);
+        }
+        return total;
+    }
+    unsigned long total = dict->length * sizeof(struct dict_bucket);
+    if (dict->old_table != NULL) {
+        total += dict->old_length * sizeof(struct dict_bucket);
+    }
+    return total;
 }
 
 static void dict_resize(struct dict *dict, unsigned int newsize) {
+    assert(dict->old_table == NULL);
 	unsigned int o = dict->length;
 	struct dict_bucket *old = dict->table;
 	dict->table = calloc(sizeof(struct dict_bucket), newsize);
@@ -119,18 +207,520 @@ static void dict_resize(struct dict *dict, unsigned int newsize) {
 	free(old);
 }
 
+// Total #entries in async mode
+static unsigned int dict_async_count(struct dict *dict){
+    unsigned int count = dict->count;
+	for (unsigned int i = 0; i < dict->nworkers; i++) {
+        count += dict->workers[i].count;
+    }
+    return count;
+}
+
+// The bucket that holds the entries with the given hash.  While the
+// table is being migrated, that is the bucket in the old table unless it
+// has been migrated already.
+static inline struct dict_bucket *dict_bucket(struct dict *dict, uint32_t hash){
+    struct dict_bucket *old = dict->old_table;
+    if (old != NULL) {
+        struct dict_bucket *db = &old[hash % dict->old_length];
+        if (db->stable != DICT_MOVED) {
+            return db;
+        }
+    }
+    return &dict->table[hash % dict->length];
+}
+
+// Start migrating to a new table.  Must be called when no other worker
+// can be holding a bucket lock.  Workers that scan the stable lists without
+// a lock may still be looking at the old table, so the new table is
+// published before its length.
+static void dict_migrate_start(struct dict *dict, unsigned int length){
+    assert(dict->old_table == NULL);
+    length = dict_round_length(dict, length);
+    struct dict_bucket *table = calloc(sizeof(struct dict_bucket), length);
+    dict->migrate_epoch++;
+    atomic_store(&dict->migrate_next, (uint64_t) dict->migrate_epoch << 32);
+    atomic_store(&dict->migrate_done, 0);
+    dict->old_length = dict->length;
+    dict->old_table = dict->table;
+    dict->table = table;
+#ifdef USE_ATOMIC
+    atomic_thread_fence(memory_order_release);
+#endif
+    dict->length = length;
+}
+
+// Move the entries in bucket i of the old table to the new table.  The
+// new buckets are covered by the same lock, which the caller holds if
+// the dictionary is concurrent.  Workers scanning the bucket without the
+// lock may miss entries while this happens, and check again with the lock.
+static void dict_migrate_bucket(struct dict *dict, unsigned int i){
+    struct dict_bucket *ob = &dict->old_table[i];
+    struct dict_assoc *k, *next;
+    for (k = ob->stable; k != NULL; k = next) {
+        next = k->next;
+        struct dict_bucket *db = &dict->table[k->hash % dict->length];
+        k->next = db->stable;
+#ifdef USE_ATOMIC
+        atomic_thread_fence(memory_order_release);
+#endif
+        db->stable = k;
+    }
+    for (k = ob->unstable; k != NULL; k = next) {
+        next = k->next;
+        struct dict_bucket *db = &dict->table[k->hash % dict->length];
+        k->next = db->unstable;
+        db->unstable = k;
+    }
+    ob->unstable = NULL;
+#ifdef USE_ATOMIC
+    atomic_thread_fence(memory_order_release);
+#endif
+    ob->stable = DICT_MOVED;
+}
+
+// All buckets have been migrated.  The old table is retired rather than
+// freed as other workers may still be scanning it.
+static void dict_migrate_end(struct dict *dict){
+    mutex_acquire(&dict->grow_lock);
+    struct dict_retired *dr = new_alloc(struct dict_retired);
+    dr->table = dict->old_table;
+    dr->next = dict->retired;
+    dict->retired = dr;
+    dict->old_table = NULL;
+    mutex_release(&dict->grow_lock);
+}
+
+// Migrate the next MIGRATE_STEP buckets of the old table, if any.  Called
+// by workers during normal finds, so the cost of growing the table is
+// spread out rather than paid all at once between rounds.
+static void dict_migrate(struct dict *dict){
+    uint64_t claim;
+#ifdef USE_ATOMIC
+    claim = atomic_fetch_add(&dict->migrate_next, MIGRATE_STEP);
+#else
+    mutex_acquire(&dict->grow_lock);
+    claim = dict->migrate_next;
+    dict->migrate_next += MIGRATE_STEP;
+    mutex_release(&dict->grow_lock);
+#endif
+    unsigned int epoch = claim >> 32, first = (unsigned int) claim;
+    unsigned int n = 0, old_length = 0;
+    for (unsigned int i = first; i < first + MIGRATE_STEP; i++) {
+        mutex_t *lock = &dict->locks[i % dict->nlocks];
+        mutex_acquire(lock);
+
+        // The migration may have ended, and another one started, since
+        // the buckets were claimed
+        bool valid = dict->old_table != NULL &&
+                dict->migrate_epoch == epoch && i < dict->old_length;
+        if (valid && dict->old_table[i].stable != DICT_MOVED) {
+            old_length = dict->old_length;
+            dict_migrate_bucket(dict, i);
+            n++;
+        }
+        mutex_release(lock);
+        if (!valid) {
+            break;
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+
+    unsigned int done;
+#ifdef USE_ATOMIC
+    done = atomic_fetch_add(&dict->migrate_done, n) + n;
+#else
+    mutex_acquire(&dict->grow_lock);
+    done = dict->migrate_done += n;
+    mutex_release(&dict->grow_lock);
+#endif
+    if (done == old_length) {
+        dict_migrate_end(dict);
+    }
+}
+
+// Finish the migration, if any, without other workers around.
+static void dict_migrate_all(struct dict *dict){
+    if (dict->old_table != NULL) {
+        for (unsigned int i = 0; i < dict->old_length; i++) {
+            if (dict->old_table[i].stable != DICT_MOVED) {
+                dict_migrate_bucket(dict, i);
+            }
+        }
+        free(dict->old_table);
+        dict->old_table = NULL;
+    }
+}
+
+static void dict_free_retired(struct dict *dict){
+    struct dict_retired *dr;
+    while ((dr = dict->retired) != NULL) {
+        dict->retired = dr->next;
+        free(dr->table);
+        free(dr);
+    }
+}
+
+// New length of the table when it grows, according to the growth policy
+static unsigned int dict_grow_length(struct dict *dict, unsigned int count){
+    unsigned int factor = dict->growth_factor;
+    while (factor * dict->length < count) {
+        factor++;
+    }
+    return dict->length * factor;
+}
+
+// Help migrating the table every so often
+static inline void dict_migrate_help(struct dict *dict, struct allocator *al){
+    if (dict->old_table != NULL && al != NULL &&
+                ++dict->workers[al->worker].ops % MIGRATE_EVERY == 0) {
+        dict_migrate(dict);
+    }
+}
+
+// Called with the bucket lock held after the key was not found in the
+// stable list of *pdb without the lock.  If the bucket has been migrated
+// in the mean time, looks again in the bucket it was migrated to.
+static struct dict_assoc *dict_rescan(struct dict *dict, struct dict_bucket **pdb,
+                const void *key, unsigned int keylen, uint32_t hash){
+    struct dict_bucket *db = dict_bucket(dict, hash);
+    if (db == *pdb) {
+        return NULL;
+    }
+    *pdb = db;
+    for (struct dict_assoc *k = db->stable; k != NULL; k = k->next) {
+        if (k->hash == hash && k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
+            return k;
+        }
+    }
+    return NULL;
+}
+
+#ifdef USE_ATOMIC
+
+// Start growing the table of a dictionary in async mode.  All bucket locks
+// are held while switching tables, but the actual migration is done
+// incrementally by the workers.
+static void dict_grow_async(struct dict *dict){
+    if (!mutex_try_acquire(&dict->grow_lock)) {
+        return;         // somebody else is already growing the table
+    }
+    if (dict->old_table != NULL) {
+        mutex_release(&dict->grow_lock);
+        return;         // previous migration is not done yet
+    }
+	for (unsigned int i = 0; i < dict->nlocks; i++) {
+        mutex_acquire(&dict->locks[i]);
+    }
+
+    // Now that we have all the locks, the count is accurate
+    unsigned int count = dict_async_count(dict);
+	if ((double) count / dict->length > dict->growth_threshold) {
+        dict_migrate_start(dict, dict_grow_length(dict, count));
+    }
+
+	for (unsigned int i = 0; i < dict->nlocks; i++) {
+        mutex_release(&dict->locks[i]);
+    }
+    mutex_release(&dict->grow_lock);
+}
+
+// dict_find() and dict_find_lock() in async mode.  New entries go
+// straight onto the stable list of their bucket while holding the bucket
+// lock, so there is no need for dict_make_stable().  If lock != NULL,
+// returns with the bucket lock held.
+static struct dict_assoc *dict_find_async(struct dict *dict, struct allocator *al,
+                const void *key, unsigned int keylen, uint32_t hash, bool *new, mutex_t **lock){
+    struct dict_worker *dw = &dict->workers[al->worker];
+    if (dw->count - dw->checked >= GROW_CHECK) {
+        dw->checked = dw->count;
+        if ((double) dict_async_count(dict) / dict->length > dict->growth_threshold) {
+            dict_grow_async(dict);
+        }
+    }
+    dict_migrate_help(dict, al);
+
+    mutex_t *mx = &dict->locks[hash % dict->nlocks];
+
+    // First see if the item is there without getting the lock.  Not
+    // while migrating, as the old table may be retired and replaced by
+    // another one while we're looking at it.
+    struct dict_bucket *db = NULL;
+    struct dict_assoc *first = NULL, *k = NULL;
+    if (dict->old_table == NULL) {
+        unsigned int length = dict->length;
+        atomic_thread_fence(memory_order_acquire);
+        db = &dict->table[hash % length];
+        first = db->stable;
+        atomic_thread_fence(memory_order_acquire);
+        if (first == DICT_MOVED) {
+            first = NULL;           // a migration just started
+        }
+        for (k = first; k != NULL; k = k->next) {
+            if (k->hash == hash && k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
+                break;
+            }
+        }
+        if (k != NULL && lock == NULL) {
+            if (new != NULL) {
+                *new = false;
+            }
+            return k;
+        }
+    }
+
+    mutex_acquire(mx);
+
+    // Only need to look at the entries added since the first scan, unless
+    // the bucket was migrated in the mean time
+    if (k == NULL) {
+        struct dict_bucket *db2 = dict_bucket(dict, hash);
+        if (db2 != db) {
+            db = db2;
+            first = NULL;
+        }
+        for (k = db->stable; k != first; k = k->next) {
+            if (k->hash == hash && k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
+                break;
+            }
+        }
+        if (k == first) {
+            k = NULL;
+        }
+    }
+
+    if (new != NULL) {
+        *new = k == NULL;
+    }
+    if (k == NULL) {
+        k = dict_assoc_new(dict, al, (char *) key, keylen, hash);
+        k->next = db->stable;
+        atomic_thread_fence(memory_order_release);
+        db->stable = k;
+        dw->count++;
+    }
+
+    if (lock == NULL) {
+        mutex_release(mx);
+    }
+    else {
+        *lock = mx;
+    }
+    return k;
+}
+
+static struct dict_open *odict_alloc(unsigned int length){
+    struct dict_open *t = new_alloc(struct dict_open);
+    unsigned int log = 10;
+    while ((1U << log) < length) {
+        log++;
+    }
+    t->length = 1U << log;
+    t->shift = 64 - log;
+    t->slots = calloc(t->length, sizeof(struct dict_slot));
+    return t;
+}
+
+// Try to claim an empty slot.  If the table already has a successor, the
+// slot is sealed instead so nobody else can claim it either.  Returns
+// true if the slot was claimed, and otherwise sets *h to the new hash.
+static inline bool odict_claim(struct dict_open *t, struct dict_slot *slot,
+                                        uint64_t fp, uint64_t *h){
+    uint64_t want = atomic_load(&t->next) == NULL ? fp : OPEN_SEALED;
+    uint64_t expected = 0;
+    if (atomic_compare_exchange_strong(&slot->hash, &expected, want)) {
+        *h = want;
+        return want == fp;
+    }
+    *h = expected;
+    return false;
+}
+
+static void odict_grow(struct dict *dict, struct dict_open *t);
+
+// Add an entry that is known not to be in the chain of tables starting
+// at t.  Follows the same probing rules as odict_find().
+static void odict_add(struct dict *dict, struct dict_open *t, uint64_t hash, struct dict_assoc *k){
+    uint64_t fp = hash | 1;
+    for (;;) {
+        unsigned int mask = t->length - 1, i = hash >> t->shift;
+        unsigned int nprobes = t->length < OPEN_PROBES ? t->length : OPEN_PROBES;
+        for (unsigned int probe = 0; probe < nprobes; probe++, i = (i + 1) & mask) {
+            struct dict_slot *slot = &t->slots[i];
+            uint64_t h = atomic_load(&slot->hash);
+            if (h == 0 && odict_claim(t, slot, fp, &h)) {
+                atomic_store(&slot->assoc, k);
+                return;
+            }
+            if (h == OPEN_SEALED) {
+                break;
+            }
+        }
+        struct dict_open *next = atomic_load(&t->next);
+        if (next == NULL) {
+            odict_grow(dict, t);
+            next = atomic_load(&t->next);
+        }
+        t = next;
+    }
+}
+
+// Table t is getting full.  Chain a larger table to it, seal the empty
+// slots in t so no more entries get added to it, and copy its entries
+// over.  Other workers carry on in the mean time: until t is marked as
+// migrated they keep looking in t as well.  The old table itself cannot
+// be freed until nobody is looking at it anymore (see dict_grow_prepare()).
+static void odict_grow(struct dict *dict, struct dict_open *t){
+    struct dict_open *next = odict_alloc(t->length * OPEN_GROWTH);
+    struct dict_open *expected = NULL;
+    if (!atomic_compare_exchange_strong(&t->next, &expected, next)) {
+        odict_free(next);       // somebody else beat us to it
+        return;
+    }
+    for (unsigned int i = 0; i < t->length; i++) {
+        uint64_t h = 0;
+        (void) atomic_compare_exchange_strong(&t->slots[i].hash, &h, OPEN_SEALED);
+    }
+    for (unsigned int i = 0; i < t->length; i++) {
+        struct dict_slot *slot = &t->slots[i];
+        uint64_t h = atomic_load(&slot->hash);
+        if (h != OPEN_SEALED) {
+            struct dict_assoc *k;
+            while ((k = atomic_load(&slot->assoc)) == NULL) {
+                sched_yield();      // being filled in by another worker
+            }
+            odict_add(dict, next, h, k);
+        }
+    }
+    atomic_store(&t->migrated, true);
+}
+
+// dict_find() for open addressing.  Looks for the key in the chain of
+// tables, skipping those that have been migrated, and probing each from
+// the slot given by the high bits of the hash.  An entry is added in the
+// first empty slot along the way, claimed with compare-and-swap on the
+// hash.  Whoever claims the slot then allocates the entry and fills in
+// the pointer.  Returns NULL if the key is not found and insert is false.
+static struct dict_assoc *odict_find(struct dict *dict, struct allocator *al,
+                const void *key, unsigned int keylen, uint64_t hash, bool insert, bool *new){
+    uint64_t fp = hash | 1;
+    struct dict_open *t = dict->open;
+    for (;;) {
+        unsigned int mask = t->length - 1, i = hash >> t->shift;
+        unsigned int nprobes = atomic_load(&t->migrated) ? 0 :
+                        t->length < OPEN_PROBES ? t->length : OPEN_PROBES;
+        for (unsigned int probe = 0; probe < nprobes; probe++, i = (i + 1) & mask) {
+            struct dict_slot *slot = &t->slots[i];
+            uint64_t h = atomic_load(&slot->hash);
+            if (h == 0) {
+                if (!insert) {
+                    if (atomic_load(&t->next) == NULL) {
+                        return NULL;
+                    }
+                    break;
+                }
+                if (odict_claim(t, slot, fp, &h)) {
+                    struct dict_assoc *k = dict_assoc_new(dict, al, (char *) key, keylen, (uint32_t) hash);
+                    atomic_store(&slot->assoc, k);
+                    if (new != NULL) {
+                        *new = true;
+                    }
+                    if (al == NULL) {
+                        dict->count++;
+                        return k;
+                    }
+
+                    // See if the table is getting full
+                    struct dict_worker *dw = &dict->workers[al->worker];
+                    if (++dw->count - dw->checked >= GROW_CHECK) {
+                        dw->checked = dw->count;
+                        if (atomic_load(&t->next) == NULL &&
+                                dict_async_count(dict) > t->length * OPEN_LOAD) {
+                            odict_grow(dict, t);
+                        }
+                    }
+                    return k;
+                }
+                // Somebody else claimed or sealed the slot, and h is now its hash
+            }
+            if (h == OPEN_SEALED) {
+                break;
+            }
+            if (h == fp) {
+                struct dict_assoc *k;
+                while ((k = atomic_load(&slot->assoc)) == NULL) {
+                    sched_yield();      // being filled in by another worker
+                }
+                if (k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
+                    if (new != NULL) {
+                        *new = false;
+                    }
+                    return k;
+                }
+            }
+        }
+
+        // Continue in the next table, adding one if needed
+        struct dict_open *next = atomic_load(&t->next);
+        if (next == NULL) {
+            if (!insert) {
+                return NULL;
+            }
+            odict_grow(dict, t);
+            next = atomic_load(&t->next);
+        }
+        t = next;
+    }
+}
+
+#endif // USE_ATOMIC
+
 // Perhaps the most performance critical function in the entire code base
 struct dict_assoc *dict_find(struct dict *dict, struct allocator *al,
                 const void *key, unsigned int keylen, bool *new){
-    uint32_t hash = hash_func(key, keylen);
+#ifdef USE_ATOMIC
+    if (dict->open != NULL) {
+        return odict_find(dict, al, key, keylen, hash64(key, keylen), true, new);
+    }
+    if (dict->ht != NULL) {
+        return (struct dict_assoc *) ht_find(dict->ht, al, key, keylen, new);
+    }
+#endif
+    return dict_find_hashed(dict, al, key, keylen, hash_func(key, keylen), new);
+}
+
+// Same as dict_find(), but with a 32-bit hash computed by the caller.  All
+// entries of a dictionary must then be found this way, with the same hash
+// function.  The hash can be retrieved later with dict_retrieve_hash().
+struct dict_assoc *dict_find_hashed(struct dict *dict, struct allocator *al,
+                const void *key, unsigned int keylen, uint32_t hash, bool *new){
+#ifdef USE_ATOMIC
+    if (dict->open != NULL) {
+        // Open addressing uses the high bits for the index, so spread
+        // the hash out over 64 bits while keeping it in the low 32.
+        uint64_t wide = (hash_mum(hash ^ HASH_P1, HASH_P2) & ~(uint64_t) 0xFFFFFFFF) | hash;
+        return odict_find(dict, al, key, keylen, wide, true, new);
+    }
+    if (dict->ht != NULL) {
+        return (struct dict_assoc *) ht_find_with_hash(dict->ht, al, hash, key, keylen, new);
+    }
+    if (dict->async) {
+        return dict_find_async(dict, al, key, keylen, hash, new, NULL);
+    }
+#endif
+    dict_migrate_help(dict, al);
 
     // First see if the item is in the stable list, which does not require
     // a lock
-    unsigned int index = hash % dict->length;
-    struct dict_bucket *db = &dict->table[index];
+    struct dict_bucket *db = dict_bucket(dict, hash);
 	struct dict_assoc *k = db->stable;
+    if (k == DICT_MOVED) {
+        k = NULL;               // just migrated; check again with the lock
+    }
 	while (k != NULL) {
-		if (k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
+		if (k->hash == hash && k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
             if (new != NULL) {
                 *new = false;
             }
@@ -139,21 +729,29 @@ struct dict_assoc *dict_find(struct dict *dict, struct allocator *al,
 		k = k->next;
 	}
 
+    mutex_t *lock = NULL;
     if (dict->concurrent) {
-        mutex_acquire(&dict->locks[index % dict->nlocks]);
+        lock = &dict->locks[hash % dict->nlocks];
+        mutex_acquire(lock);
+
+        // The bucket may have been migrated while we were looking
+        k = dict_rescan(dict, &db, key, keylen, hash);
 
         // See if the item is in the unstable list
-        k = db->unstable;
-        while (k != NULL) {
-            if (k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
-                mutex_release(&dict->locks[index % dict->nlocks]);
-                dict->workers[al->worker].clashes++;
-                if (new != NULL) {
-                    *new = false;
+        if (k == NULL) {
+            for (k = db->unstable; k != NULL; k = k->next) {
+                if (k->hash == hash && k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
+                    dict->workers[al->worker].clashes++;
+                    break;
                 }
-                return k;
             }
-            k = k->next;
+        }
+        if (k != NULL) {
+            mutex_release(lock);
+            if (new != NULL) {
+                *new = false;
+            }
+            return k;
         }
     }
 
@@ -161,8 +759,8 @@ struct dict_assoc *dict_find(struct dict *dict, struct allocator *al,
 	if (!dict->concurrent && db->stable == NULL) {
 		double f = (double)dict->count / (double)dict->length;
 		if (f > dict->growth_threshold) {
-			dict_resize(dict, dict->length * dict->growth_factor - 1);
-			return dict_find(dict, al, key, keylen, new);
+			dict_resize(dict, dict_round_length(dict, dict->length * dict->growth_factor - 1));
+			return dict_find_hashed(dict, al, key, keylen, hash, new);
 		}
 	}
 
@@ -170,11 +768,11 @@ struct dict_assoc *dict_find(struct dict *dict, struct allocator *al,
     if (dict->concurrent) {
         k->next = db->unstable;
         db->unstable = k;
-        mutex_release(&dict->locks[index % dict->nlocks]);
+        mutex_release(lock);
 
         // Keep track of this unstable node in the list for the
         // worker who's going to look at this bucket
-        unsigned int worker = index * dict->nworkers / dict->length;
+        unsigned int worker = (hash % dict->nlocks) * dict->nworkers / dict->nlocks;
         struct dict_worker *dw = &dict->workers[al->worker];
         k->unstable_next = dw->unstable[worker];
         dw->unstable[worker] = k;
@@ -195,16 +793,49 @@ struct dict_assoc *dict_find(struct dict *dict, struct allocator *al,
 // Similar to dict_find(), but gets a lock on the bucket
 struct dict_assoc *dict_find_lock(struct dict *dict, struct allocator *al,
                             const void *key, unsigned int keylen, bool *new, mutex_t **lock){
+#ifdef USE_ATOMIC
+    if (dict->ht != NULL) {
+        return (struct dict_assoc *) ht_find_lock(dict->ht, al, key, keylen, new, lock);
+    }
+#endif
+    uint64_t hash = dict->open != NULL ? hash64(key, keylen) : hash_func(key, keylen);
+    return dict_find_lock_hashed(dict, al, key, keylen, hash, new, lock);
+}
+
+// Same as dict_find_lock(), but with a hash computed by the caller.  All
+// entries of a dictionary must then be found this way, with the same hash
+// function.  Only the lower 32 bits of the hash are used by chained tables.
+struct dict_assoc *dict_find_lock_hashed(struct dict *dict, struct allocator *al,
+                            const void *key, unsigned int keylen, uint64_t fullhash,
+                            bool *new, mutex_t **lock){
     assert(dict->concurrent);
     assert(al != NULL);
-    uint32_t hash = hash_func(key, keylen);
-    unsigned int index = hash % dict->length;
-    *lock = &dict->locks[index % dict->nlocks];
+#ifdef USE_ATOMIC
+    if (dict->open != NULL) {
+        struct dict_assoc *k = odict_find(dict, al, key, keylen, fullhash, true, new);
+        *lock = &dict->locks[(fullhash >> 32) % dict->nlocks];
+        mutex_acquire(*lock);
+        return k;
+    }
+    if (dict->ht != NULL) {
+        return (struct dict_assoc *) ht_find_lock_with_hash(dict->ht, al,
+                (uint32_t) (fullhash ^ (fullhash >> 32)), key, keylen, new, lock);
+    }
+    if (dict->async) {
+        return dict_find_async(dict, al, key, keylen, (uint32_t) fullhash, new, lock);
+    }
+#endif
+    dict_migrate_help(dict, al);
+    uint32_t hash = (uint32_t) fullhash;
+    *lock = &dict->locks[hash % dict->nlocks];
 
-    struct dict_bucket *db = &dict->table[index];
+    struct dict_bucket *db = dict_bucket(dict, hash);
 	struct dict_assoc *k = db->stable;
+    if (k == DICT_MOVED) {
+        k = NULL;
+    }
 	while (k != NULL) {
-		if (k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
+		if (k->hash == hash && k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
             if (new != NULL) {
                 *new = false;
             }
@@ -214,14 +845,21 @@ struct dict_assoc *dict_find_lock(struct dict *dict, struct allocator *al,
 		k = k->next;
 	}
 
-    unsigned int worker = index * dict->nworkers / dict->length;
     struct dict_worker *dw = &dict->workers[al->worker];
 
     mutex_acquire(*lock);
+    k = dict_rescan(dict, &db, key, keylen, hash);
+    if (k != NULL) {
+        if (new != NULL) {
+            *new = false;
+        }
+        return k;
+    }
+
     // See if the item is in the unstable list
     k = db->unstable;
     while (k != NULL) {
-        if (k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
+        if (k->hash == hash && k->len == keylen && memcmp((char *) &k[1] + dict->value_len, key, keylen) == 0) {
             dw->clashes++;
             if (new != NULL) {
                 *new = false;
@@ -238,6 +876,7 @@ struct dict_assoc *dict_find_lock(struct dict *dict, struct allocator *al,
 
     // Keep track of this unstable node in the list for the
     // worker who's going to look at this bucket
+    unsigned int worker = (hash % dict->nlocks) * dict->nworkers / dict->nlocks;
     k->unstable_next = dw->unstable[worker];
     dw->unstable[worker] = k;
     dw->count++;
@@ -265,18 +904,33 @@ void *dict_retrieve(const void *p, unsigned int *psize){
     return (char *) &k[1];
 }
 
+// The hash an entry was found with by dict_find_hashed()
+uint32_t dict_retrieve_hash(const void *p){
+    const struct dict_assoc *k = p;
+    return k->hash;
+}
+
 // This assumes that the value is a pointer.  Returns NULL if there is
 // no entry but does not create an entry.
 void *dict_lookup(struct dict *dict, const void *key, unsigned int keylen) {
+    assert(dict->ht == NULL);       // not supported by hashtab.c
+#ifdef USE_ATOMIC
+    if (dict->open != NULL) {
+        struct dict_assoc *k = odict_find(dict, NULL, key, keylen, hash64(key, keylen), false, NULL);
+        return k == NULL ? NULL : * (void **) &k[1];
+    }
+#endif
     uint32_t hash = hash_func(key, keylen);
-    unsigned int index = hash % dict->length;
-    struct dict_bucket *db = &dict->table[index];
+    struct dict_bucket *db = dict_bucket(dict, hash);
 	// __builtin_prefetch(db);
 
     // First look in the stable list, which does not require a lock
 	struct dict_assoc *k = db->stable;
+    if (k == DICT_MOVED) {
+        k = NULL;
+    }
 	while (k != NULL) {
-		if (k->len == keylen && !memcmp((char *) &k[1] + dict->value_len, key, keylen)) {
+		if (k->hash == hash && k->len == keylen && !memcmp((char *) &k[1] + dict->value_len, key, keylen)) {
             return * (void **) &k[1];
 		}
 		k = k->next;
@@ -284,25 +938,33 @@ void *dict_lookup(struct dict *dict, const void *key, unsigned int keylen) {
 
     // Look in the unstable list
     if (dict->concurrent) {
-        mutex_acquire(&dict->locks[index % dict->nlocks]);
-        k = db->unstable;
-        while (k != NULL) {
-            if (k->len == keylen && !memcmp((char *) &k[1] + dict->value_len, key, keylen)) {
-                mutex_release(&dict->locks[index % dict->nlocks]);
-                return * (void **) &k[1];
+        mutex_t *lock = &dict->locks[hash % dict->nlocks];
+        mutex_acquire(lock);
+        k = dict_rescan(dict, &db, key, keylen, hash);
+        if (k == NULL) {
+            for (k = db->unstable; k != NULL; k = k->next) {
+                if (k->hash == hash && k->len == keylen && !memcmp((char *) &k[1] + dict->value_len, key, keylen)) {
+                    break;
+                }
             }
-            k = k->next;
         }
-        mutex_release(&dict->locks[index % dict->nlocks]);
+        mutex_release(lock);
+        if (k != NULL) {
+            return * (void **) &k[1];
+        }
     }
 
 	return NULL;
 }
 
-void dict_iter(struct dict *dict, dict_enumfunc f, void *env) {
-	for (unsigned int i = 0; i < dict->length; i++) {
-        struct dict_bucket *db = &dict->table[i];
+static void dict_iter_table(struct dict *dict, struct dict_bucket *table,
+                        unsigned int length, dict_enumfunc f, void *env) {
+	for (unsigned int i = 0; i < length; i++) {
+        struct dict_bucket *db = &table[i];
         struct dict_assoc *k = db->stable;
+        if (k == DICT_MOVED) {
+            continue;
+        }
         while (k != NULL) {
             (*f)(env, (char *) &k[1] + dict->value_len, k->len, &k[1]);
             k = k->next;
@@ -319,10 +981,100 @@ void dict_iter(struct dict *dict, dict_enumfunc f, void *env) {
 	}
 }
 
+void dict_iter(struct dict *dict, dict_enumfunc f, void *env) {
+    assert(dict->ht == NULL);       // not supported by hashtab.c
+    for (struct dict_open *t = dict->open; t != NULL; t = t->next) {
+        if (t->migrated) {
+            continue;
+        }
+        for (unsigned int i = 0; i < t->length; i++) {
+            struct dict_assoc *k = t->slots[i].assoc;
+            if (k != NULL) {
+                (*f)(env, (char *) &k[1] + dict->value_len, k->len, &k[1]);
+            }
+        }
+    }
+    if (dict->old_table != NULL) {
+        dict_iter_table(dict, dict->old_table, dict->old_length, f, env);
+    }
+    dict_iter_table(dict, dict->table, dict->length, f, env);
+}
+
+// Set the growth policy: once there are more than threshold entries per
+// bucket on average, the table grows by the given factor (or more if
+// needed).
+void dict_set_growth(struct dict *dict, unsigned int factor, double threshold) {
+    assert(factor >= 2 && threshold > 0);
+    dict->growth_factor = factor;
+    dict->growth_threshold = threshold;
+}
+
 // Switch to concurrent mode
 void dict_set_concurrent(struct dict *dict) {
     assert(!dict->concurrent);
     dict->concurrent = true;
+    if (dict->ht != NULL) {
+        ht_set_concurrent(dict->ht);
+    }
+}
+
+// Switch to async concurrent mode, in which entries are inserted directly
+// into the stable lists and the table grows on demand rather than through
+// dict_grow_prepare() and dict_make_stable().  Requires USE_ATOMIC.
+void dict_set_async(struct dict *dict) {
+    assert(!dict->concurrent);
+    assert(dict->ht == NULL);       // hashtab.c relies on dict_make_stable()
+#ifdef USE_ATOMIC
+    dict->concurrent = true;
+    dict->async = true;
+	for (unsigned int i = 0; i < dict->nworkers; i++) {
+        dict->workers[i].checked = 0;
+    }
+#else
+    assert(false);
+#endif
+}
+
+// Switch to open addressing (see odict_find()).  Must be done while the
+// dictionary is still sequential.  Existing entries are moved over.
+// Requires USE_ATOMIC.
+void dict_set_open(struct dict *dict) {
+    assert(!dict->concurrent);
+    assert(dict->open == NULL);
+#ifdef USE_ATOMIC
+    dict->open = odict_alloc(OPEN_GROWTH * (dict->count > dict->length ?
+                                        dict->count : dict->length));
+	for (unsigned int i = 0; i < dict->length; i++) {
+        struct dict_assoc *k = dict->table[i].stable;
+        while (k != NULL) {
+            struct dict_assoc *next = k->next;
+            odict_add(dict, dict->open,
+                hash64((char *) &k[1] + dict->value_len, k->len), k);
+            k = next;
+        }
+    }
+    free(dict->table);
+    dict->table = NULL;
+    dict->length = 0;
+#else
+    assert(false);
+#endif
+}
+
+// Use the table of hashtab.c instead (see hashtab.h).  Its nodes are laid
+// out like dict_assoc entries, so the rest of the code does not know the
+// difference.  Must be done while the dictionary is still empty.
+// Requires USE_ATOMIC.
+void dict_set_hashtab(struct dict *dict) {
+    assert(!dict->concurrent);
+    assert(dict->count == 0 && dict->open == NULL && dict->ht == NULL);
+#ifdef USE_ATOMIC
+    assert(sizeof(struct ht_node) == sizeof(struct dict_assoc));
+    assert(offsetof(struct ht_node, size) == offsetof(struct dict_assoc, len));
+    dict->ht = ht_new(dict->whoami, dict->value_len, 0, dict->nworkers, dict->align16);
+#else
+    assert(false);
+#endif
 }
 
 // When going from concurrent to sequential, need to move over
@@ -330,50 +1082,79 @@ void dict_set_concurrent(struct dict *dict) {
 void dict_make_stable(struct dict *dict, unsigned int worker){
     assert(dict->concurrent);
 
-    if (dict->length != dict->old_length) {
-        unsigned int first = (uint64_t) worker * dict->old_length / dict->nworkers;
-        unsigned int last = (uint64_t) (worker + 1) * dict->old_length / dict->nworkers;
-        for (unsigned i = first; i < last; i++) {
-            struct dict_bucket *b = &dict->old_table[i];
-            struct dict_assoc *k = b->stable;
-            while (k != NULL) {
-                struct dict_assoc *next = k->next;
-                dict_reinsert_when_resizing(dict, k);
-                k = next;
+    if (dict->ht != NULL) {
+        ht_make_stable(dict->ht, worker);
+        return;
+    }
+
+#ifdef USE_ATOMIC
+    // With open addressing, the only thing to do is to copy the entries
+    // over if the table is being grown.
+    if (dict->open != NULL) {
+        struct dict_open *t = dict->open_old;
+        if (t != NULL) {
+            unsigned int first = (uint64_t) worker * t->length / dict->nworkers;
+            unsigned int last = (uint64_t) (worker + 1) * t->length / dict->nworkers;
+            for (unsigned i = first; i < last; i++) {
+                uint64_t h = t->slots[i].hash;
+                if (h != 0 && h != OPEN_SEALED) {
+                    odict_add(dict, dict->open, h, t->slots[i].assoc);
+                }
             }
         }
+        return;
     }
+#endif
 
+    // The unstable entries of this worker are those covered by its share
+    // of the locks.  They go into the bucket they are in now, which may be
+    // in the old table if the table is being migrated.
 	for (unsigned int i = 0; i < dict->nworkers; i++) {
         struct dict_worker *dw = &dict->workers[i];
         struct dict_assoc *k;
         while ((k = dw->unstable[worker]) != NULL) {
-            uint32_t hash = hash_func((char *) &k[1] + dict->value_len, k->len);
-            unsigned int index = hash % dict->length;
-            struct dict_bucket *db = &dict->table[index];
+            struct dict_bucket *db = dict_bucket(dict, k->hash);
             dw->unstable[worker] = k->unstable_next;
             k->next = db->stable;
             k->unstable_next = NULL;
             db->stable = k;
-            if (dict->table == dict->old_table) {
-                db->unstable = NULL;
-            }
+            db->unstable = NULL;
         }
     }
 }
 
 // Figure out how much this dictionary should grow by adding up the
-// unstable entries.  The actual rehashing happens later.
+// unstable entries.  If it has to grow, a new table is allocated, but the
+// entries are migrated incrementally by the workers (see dict_migrate()).
 void dict_grow_prepare(struct dict *dict){
     assert(dict->concurrent);
 
-    if (dict->old_table != dict->table) {
-        free(dict->old_table);
-        dict->old_table = dict->table;
+    if (dict->ht != NULL) {
+        ht_grow_prepare(dict->ht);
+        return;
     }
-    dict->old_count = dict->count;
-    dict->old_length = dict->length;
-    dict->old_table = dict->table;
+
+#ifdef USE_ATOMIC
+    // With open addressing, nobody is looking at the tables that have been
+    // migrated anymore, so they can be freed.  Then grow the table if it's
+    // getting full, so it is less likely to have to happen in the next round.
+    if (dict->open != NULL) {
+        odict_prune(dict);
+        for (unsigned int i = 0; i < dict->nworkers; i++) {
+            struct dict_worker *dw = &dict->workers[i];
+            dict->count += dw->count;
+            dw->count = dw->checked = 0;
+        }
+        if (dict->count > dict->open->length / 2) {
+            dict->open_old = dict->open;
+            dict->open = odict_alloc(OPEN_GROWTH * dict->count);
+        }
+        return;
+    }
+#endif
+
+    // Nobody is looking at old tables anymore
+    dict_free_retired(dict);
 
     unsigned int total = 0;
 	for (unsigned int i = 0; i < dict->nworkers; i++) {
@@ -383,22 +1164,95 @@ void dict_grow_prepare(struct dict *dict){
     }
     dict->count += total;
 	if ((double) dict->count / dict->length > dict->growth_threshold) {
-        int factor = dict->growth_factor;
-        while (factor * dict->length < dict->count) {
-            factor++;
+        // Unlikely, but the previous migration may not be done yet
+        dict_migrate_all(dict);
+        dict_migrate_start(dict, dict_grow_length(dict, dict->count));
+    }
+}
+
+// Chain length statistics of a table
+static void dict_chain_stats(struct dict_bucket *table, unsigned int length,
+        unsigned long *entries, unsigned long *used, unsigned int *max_chain,
+        unsigned long *collisions){
+	for (unsigned int i = 0; i < length; i++) {
+        struct dict_bucket *db = &table[i];
+        if (db->stable == DICT_MOVED) {
+            continue;
+        }
+        unsigned int n = 0;
+        for (struct dict_assoc *k = db->stable; k != NULL; k = k->next) {
+            // See if an earlier entry in the bucket has the same hash
+            for (struct dict_assoc *k2 = db->stable; k2 != k; k2 = k2->next) {
+                if (k2->hash == k->hash) {
+                    (*collisions)++;
+                    break;
+                }
+            }
+            n++;
+        }
+        if (n > 0) {
+            *entries += n;
+            (*used)++;
+            if (n > *max_chain) {
+                *max_chain = n;
+            }
         }
-        dict->length *= factor;
-        dict->table = calloc(sizeof(struct dict_bucket), dict->length);
     }
 }
 
+// Print statistics about the dictionary.  For chained tables these are
+// the chain lengths and the number of entries whose hash is the same as
+// that of another entry in the same bucket.  For open addressing, these
+// are the probe distances.  Should only be called when there are no
+// unstable entries.
 void dict_dump(struct dict *dict){
+    if (dict->ht != NULL) {
+        ht_dump(dict->ht);
+        return;
+    }
+
     unsigned int clashes = 0;
     for (unsigned int i = 0; i < dict->nworkers; i++) {
         struct dict_worker *dw = &dict->workers[i];
         clashes += dw->clashes;
     }
-    printf("%s: %u clashes\n", dict->whoami, clashes);
+
+    if (dict->open != NULL) {
+        unsigned long entries = 0, total = 0, slots = 0;
+        unsigned int max_probe = 0;
+        for (struct dict_open *t = dict->open; t != NULL; t = t->next) {
+            if (t->migrated) {
+                continue;
+            }
+            slots += t->length;
+            for (unsigned int i = 0; i < t->length; i++) {
+                uint64_t h = t->slots[i].hash;
+                if (h != 0 && h != OPEN_SEALED) {
+                    unsigned int probe = (i - (unsigned int) (h >> t->shift)) & (t->length - 1);
+                    entries++;
+                    total += probe;
+                    if (probe > max_probe) {
+                        max_probe = probe;
+                    }
+                }
+            }
+        }
+        printf("%s: %lu entries, %lu slots (load %.2lf), avg probe %.2lf, max probe %u\n",
+                dict->whoami, entries, slots, (double) entries / slots,
+                entries == 0 ? 0.0 : (double) total / entries, max_probe);
+        return;
+    }
+
+    unsigned long entries = 0, used = 0, collisions = 0;
+    unsigned int max_chain = 0, length = dict->length;
+    if (dict->old_table != NULL) {
+        dict_chain_stats(dict->old_table, dict->old_length, &entries, &used, &max_chain, &collisions);
+        length += dict->old_length;     // still migrating
+    }
+    dict_chain_stats(dict->table, dict->length, &entries, &used, &max_chain, &collisions);
+    printf("%s: %lu entries, %u buckets (%lu used), avg chain %.2lf, max chain %u, %lu hash collisions, %u clashes\n",
+                dict->whoami, entries, length, used,
+                used == 0 ? 0.0 : (double) entries / used, max_chain, collisions, clashes);
 }
 
 void dict_set_sequential(struct dict *dict) {
@@ -421,5 +1275,21 @@ void dict_set_sequential(struct dict *dict) {
     }
 #endif
 
+    if (dict->async) {
+        dict->count = dict_async_count(dict);
+        for (unsigned int i = 0; i < dict->nworkers; i++) {
+            dict->workers[i].count = 0;
+        }
+        dict->async = false;
+    }
+    if (dict->open != NULL) {
+        odict_prune(dict);
+    }
+    if (dict->ht != NULL) {
+        ht_set_sequential(dict->ht);
+    }
+    dict_migrate_all(dict);
+    dict_free_retired(dict);
+
     dict->concurrent = false;
 }
@@ -7,6 +7,7 @@
 #include <string.h> /* memcpy/memcmp */
 
 #include "thread.h"
+#include "hashtab.h"    // for hAtomic
 
 typedef void (*dict_enumfunc)(void *env, const void *key, unsigned int key_size,
                                 void *value);
@@ -17,6 +18,7 @@ struct dict_assoc {
 	struct dict_assoc *next;
     struct dict_assoc *unstable_next;
 	unsigned int len;               // key length
+    uint32_t hash;                  // hash of the key (lower 32 bits)
 };
 
 // TODO.  Split into two tables, one for stable, one for unstable.
@@ -28,6 +30,33 @@ struct dict_worker {
     struct dict_assoc **unstable;   // one for each of the workers
     unsigned int count;             // #unstable entries added
     unsigned int clashes;           // some profiling
+    unsigned int checked;           // count at last growth check (async mode)
+    unsigned int ops;               // #finds, to pace migration
+};
+
+// Slot in an open addressing table.  Besides a pointer to the dict_assoc,
+// which is still followed by the value and then the key, a slot holds the
+// 64-bit hash of the key so keys are only compared if the hashes match.
+struct dict_slot {
+    hAtomic(uint64_t) hash;                 // 0 if empty
+    hAtomic(struct dict_assoc *) assoc;     // NULL until filled in
+};
+
+// An open addressing table that fills up is sealed, a larger one is
+// chained to it, and its entries are copied over to the larger one.
+struct dict_open {
+    hAtomic(struct dict_open *) next;       // next (larger) table
+    hAtomic(bool) migrated;                 // all entries copied to next
+    struct dict_slot *slots;
+    unsigned int length;                    // #slots, a power of 2
+    unsigned int shift;                     // 64 - log2(length)
+};
+
+// Old tables cannot be freed until no other worker may still be scanning
+// them, which is at the next dict_grow_prepare() or dict_set_sequential().
+struct dict_retired {
+    struct dict_retired *next;
+    struct dict_bucket *table;
 };
 		
 struct dict {
@@ -35,8 +64,11 @@ struct dict {
     unsigned int value_len;
 	struct dict_bucket *table;
 	unsigned int length, count;
-	struct dict_bucket *old_table;
-	unsigned int old_length, old_count;
+	struct dict_bucket *old_table;  // table being migrated, or NULL
+	unsigned int old_length;
+    unsigned int migrate_epoch;             // #migrations started
+    hAtomic(uint64_t) migrate_next;         // epoch << 32 | next old bucket
+    hAtomic(unsigned int) migrate_done;     // #old buckets migrated
     struct dict_worker *workers;
     unsigned int nworkers;
     mutex_t *locks;
@@ -44,6 +76,12 @@ struct dict {
 	double growth_threshold;
 	unsigned int growth_factor;
     bool concurrent;         // 0 = not concurrent
+    bool async;              // concurrent without stable/unstable phases
+    mutex_t grow_lock;       // held while starting or ending a migration
+    struct dict_retired *retired;   // old tables
+    struct dict_open *open;         // open addressing tables if not NULL
+    struct dict_open *open_old;     // open table being copied (sync mode)
+    struct hashtab *ht;             // hashtab.c backend if not NULL
     bool align16;            // entries must be aligned to 16 bytes
 };
 
@@ -54,10 +92,17 @@ void *dict_lookup(struct dict *dict, const void *key, unsigned int keylen);
 bool dict_remove(struct dict *dict, const void *key, unsigned int keylen);
 void *dict_insert(struct dict *dict, struct allocator *al, const void *key, unsigned int keylen, bool *is_new);
 struct dict_assoc *dict_find_lock(struct dict *dict, struct allocator *al, const void *key, unsigned int keyn, bool *is_new, mutex_t **lock);
+struct dict_assoc *dict_find_lock_hashed(struct dict *dict, struct allocator *al, const void *key, unsigned int keyn, uint64_t hash, bool *is_new, mutex_t **lock);
 struct dict_assoc *dict_find(struct dict *dict, struct allocator *al, const void *key, unsigned int keylen, bool *is_new);
+struct dict_assoc *dict_find_hashed(struct dict *dict, struct allocator *al, const void *key, unsigned int keylen, uint32_t hash, bool *is_new);
 void *dict_retrieve(const void *p, unsigned int *psize);
+uint32_t dict_retrieve_hash(const void *p);
 void dict_iter(struct dict *dict, dict_enumfunc f, void *user);
 void dict_set_concurrent(struct dict *dict);
+void dict_set_async(struct dict *dict);
+void dict_set_open(struct dict *dict);
+void dict_set_hashtab(struct dict *dict);
+void dict_set_growth(struct dict *dict, unsigned int factor, double threshold);
 void dict_make_stable(struct dict *dict, unsigned int worker);
 void dict_set_sequential(struct dict *dict);
 void dict_grow_prepare(struct dict *dict);
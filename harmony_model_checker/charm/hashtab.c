@@ -5,6 +5,7 @@
 #include <assert.h>
 #include "global.h"
 #include "hashtab.h"
+#include "hash.h"
 // #include "komihash.h"
 
 #define LOG_UNSTABLE      12
@@ -12,8 +13,12 @@
 #define GROW_FACTOR        8
 
 // #define hash_func(key, size) komihash(key, size, 0)
-#define hash_func(key, size) meiyan(key, size)
 // #define hash_func(key, size) djb2(key, size)
+#ifdef USE_HASH64
+#define hash_func(key, size) hash32(key, size)
+#else
+#define hash_func(key, size) meiyan_reversed(key, size)
+#endif
 
 #ifdef NOT_NEEDED
 static inline unsigned long djb2(const char *key, int count) {
@@ -26,20 +31,8 @@ static inline unsigned long djb2(const char *key, int count) {
 }
 #endif
 
-static inline uint32_t meiyan(const char *key, int count) {
-	typedef uint32_t *P;
-	uint32_t h = 0x811c9dc5;
-	while (count >= 8) {
-		h = (h ^ ((((*(P)key) << 5) | ((*(P)key) >> 27)) ^ *(P)(key + 4))) * 0xad3e7;
-		count -= 8;
-		key += 8;
-	}
-	#define tmp h = (h ^ *(uint16_t*)key) * 0xad3e7; key += 2;
-	if (count & 4) { tmp tmp }
-	if (count & 2) { tmp }
-	if (count & 1) { h = (h ^ *key) * 0xad3e7; }
-	#undef tmp
-	h ^= (h >> 16);
+static inline uint32_t meiyan_reversed(const char *key, int count) {
+    uint32_t h = meiyan(key, count);
 
     // now reverse the bits
 	h = ((h & 0xaaaaaaaa) >> 1) | ((h & 0x55555555) << 1);
@@ -156,6 +149,9 @@ struct ht_node *ht_find_with_hash(struct hashtab *ht, struct allocator *al, unsi
             break;
         }
         if (expected->hash == hash && expected->size == size && memcmp((char *) &expected[1] + ht->value_size, key, size) == 0) {
+            if (ht->concurrent) {
+                ht->workers[al->worker].clashes++;
+            }
             if (is_new != NULL) {
                 *is_new = false;
             }
@@ -196,6 +192,9 @@ struct ht_node *ht_find_with_hash(struct hashtab *ht, struct allocator *al, unsi
         }
         else if (expected->hash == hash && expected->size == size && memcmp((char *) &expected[1] + ht->value_size, key, size) == 0) {
             // somebody else beat me to it
+            if (ht->concurrent) {
+                ht->workers[al->worker].clashes++;
+            }
             if (al == NULL) {
                 free(desired);
             }
@@ -216,6 +215,9 @@ struct ht_node *ht_find_with_hash(struct hashtab *ht, struct allocator *al, unsi
     struct ht_node **pn = &ht->unstable[segment].list, *n;
     while ((n = *pn) != NULL) {
         if (n->hash == hash && n->size == size && memcmp((char *) &n[1] + ht->value_size, key, size) == 0) {
+            if (ht->concurrent) {
+                ht->workers[al->worker].clashes++;
+            }
             break;
         }
         pn = &n->next.unstable;
@@ -259,14 +261,23 @@ struct ht_node *ht_find(struct hashtab *ht, struct allocator *al, const void *ke
     return ht_find_with_hash(ht, al, hash, key, size, is_new);
 }
 
-struct ht_node *ht_find_lock(struct hashtab *ht, struct allocator *al,
-                            const void *key, unsigned int size, bool *new, ht_lock_t **lock){
-    unsigned int hash = hash_func(key, size);
+// Like ht_find(), but returns with *lock held.  The lock is the same for
+// all finds of a given key.
+struct ht_node *ht_find_lock_with_hash(struct hashtab *ht, struct allocator *al,
+                            unsigned int hash, const void *key, unsigned int size,
+                            bool *new, ht_lock_t **lock){
     struct ht_node *n = ht_find_with_hash(ht, al, hash, key, size, new);
     *lock = &ht->locks[hash % ht->nlocks];
+    ht_lock_acquire(*lock);
     return n;
 }
 
+struct ht_node *ht_find_lock(struct hashtab *ht, struct allocator *al,
+                            const void *key, unsigned int size, bool *new, ht_lock_t **lock){
+    unsigned int hash = hash_func(key, size);
+    return ht_find_lock_with_hash(ht, al, hash, key, size, new, lock);
+}
+
 void *ht_retrieve(struct ht_node *n, unsigned int *psize){
     if (psize != NULL) {
         *psize = n->size;
@@ -382,7 +393,6 @@ void ht_grow_prepare(struct hashtab *ht){
 
         // See if the stable table needs to grow
         if ((1u << (ht->log_unstable + ht->log_stable)) < ht->stable_count * GROW_THRESHOLD) {
-            printf("GROW %s %u %u %u\n", ht->whoami, unstable_count, ht->log_stable, ht->log_unstable);
             ht->old_log_stable = ht->log_stable;
             ht->old_stable = ht->stable;
             ht->log_stable = ht->log_stable + 2;
@@ -415,3 +425,52 @@ bool ht_needs_to_grow(struct hashtab *ht){
     return r;
 #endif
 }
+
+// Print statistics about the table, in the same format as dict_dump()
+void ht_dump(struct hashtab *ht){
+    unsigned int clashes = 0;
+    for (unsigned int i = 0; i < ht->nworkers; i++) {
+        clashes += ht->workers[i].clashes;
+    }
+
+    unsigned long entries = 0, used = 0, collisions = 0;
+    unsigned int max_chain = 0;
+    unsigned int nstable = 1u << (ht->log_unstable + ht->log_stable);
+    unsigned int nbuckets = nstable + (1u << ht->log_unstable);
+    for (unsigned int i = 0; i < nbuckets; i++) {
+        struct ht_node *first = i < nstable ? ht->stable[i] :
+                        atomic_load(&ht->unstable[i - nstable].list);
+        unsigned int n = 0;
+        for (struct ht_node *hn = first; hn != NULL; hn = hn->next.stable) {
+            // See if an earlier entry in the bucket has the same hash
+            for (struct ht_node *hn2 = first; hn2 != hn; hn2 = hn2->next.stable) {
+                if (hn2->hash == hn->hash) {
+                    collisions++;
+                    break;
+                }
+            }
+            n++;
+        }
+        if (n > 0) {
+            entries += n;
+            used++;
+            if (n > max_chain) {
+                max_chain = n;
+            }
+        }
+    }
+    printf("%s: %lu entries, %u buckets (%lu used), avg chain %.2lf, max chain %u, %lu hash collisions, %u clashes\n",
+                ht->whoami, entries, nbuckets, used,
+                used == 0 ? 0.0 : (double) entries / used, max_chain, collisions, clashes);
+}
+
+// Frees the table but not the nodes, which are owned by the allocators
+void ht_delete(struct hashtab *ht){
+    free(ht->unstable);
+    free(ht->stable);
+    free(ht->old_stable);
+    free(ht->locks);
+    free(ht->counts);
+    free(ht->workers);
+    free(ht);
+}
@@ -16,18 +16,22 @@
 #include <stdlib.h>
 #include "thread.h"
 
-// followed directly by data of `size' bytes
+// followed directly by data of `size' bytes.  Laid out like struct
+// dict_assoc so a hashtab can serve as the backend of a dict (see
+// dict_set_hashtab()) and dict_retrieve() works on its nodes.
 struct ht_node {
     union {
         struct ht_node *stable;
         hAtomic(struct ht_node *) unstable;
     } next;
+    void *unused;
     uint32_t size;
     uint32_t hash;
 };
 
 struct ht_worker {
     unsigned int first, last;
+    unsigned int clashes;       // #finds of items added by other workers
 };
 
 // #define USE_SPINLOCK    // TODO
@@ -102,7 +106,9 @@ struct hashtab *ht_new(char *whoami, unsigned int value_size, unsigned int log_b
 void ht_resize(struct hashtab *ht, unsigned int log_buckets);
 void *ht_retrieve(struct ht_node *n, unsigned int *psize);
 struct ht_node *ht_find(struct hashtab *ht, struct allocator *al, const void *key, unsigned int size, bool *is_new);
+struct ht_node *ht_find_with_hash(struct hashtab *ht, struct allocator *al, unsigned int hash, const void *key, unsigned int size, bool *is_new);
 struct ht_node *ht_find_lock(struct hashtab *ht, struct allocator *al, const void *key, unsigned int size, bool *is_new, ht_lock_t **plock);
+struct ht_node *ht_find_lock_with_hash(struct hashtab *ht, struct allocator *al, unsigned int hash, const void *key, unsigned int size, bool *is_new, ht_lock_t **plock);
 void *ht_insert(struct hashtab *ht, struct allocator *al,
                         const void *key, unsigned int size, bool *new);
 void ht_set_concurrent(struct hashtab *ht);
@@ -111,5 +117,7 @@ void ht_set_sequential(struct hashtab *ht);
 void ht_grow_prepare(struct hashtab *ht);
 unsigned long ht_allocated(struct hashtab *ht);
 bool ht_needs_to_grow(struct hashtab *ht);
+void ht_dump(struct hashtab *ht);
+void ht_delete(struct hashtab *ht);
 
 #endif //SRC_HASHTAB_H
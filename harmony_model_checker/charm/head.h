@@ -19,3 +19,7 @@ void *my_aligned_alloc(size_t alignment, size_t size);
 #ifndef __STDC_NO_ATOMICS__
 #define USE_ATOMIC
 #endif
+
+// Use the 64-bit hash (see hash.h) rather than meiyan for all hash tables.
+// Comment out to go back to meiyan.
+#define USE_HASH64
@@ -1263,13 +1263,24 @@ void op_Go(
     step->ctx->pc++;
 }
 
+// The initial thread may run more than once (in swarm and random-walk
+// mode), so a predicate is only added the first time.  The arrays are
+// allocated up front by ops_predicates_alloc() so that they do not move
+// while other workers are checking predicates.
 void op_Finally(const void *env, struct state *state, struct step *step, struct global *global){
     const struct env_Finally *ef = env;
 
     mutex_acquire(&global->inv_lock);
-    global->finals = realloc(global->finals, (global->nfinals + 1) * sizeof(*global->finals));
-    unsigned int *fin = &global->finals[global->nfinals++];
-    *fin = ef->pc;
+    unsigned int i;
+    for (i = 0; i < global->nfinals; i++) {
+        if (global->finals[i] == ef->pc) {
+            break;
+        }
+    }
+    if (i == global->nfinals) {
+        global->finals[i] = ef->pc;
+        global->nfinals++;
+    }
     mutex_release(&global->inv_lock);
 
     step->ctx->pc += 1;
@@ -1279,12 +1290,20 @@ void op_Invariant(const void *env, struct state *state, struct step *step, struc
     const struct env_Invariant *ei = env;
 
     mutex_acquire(&global->inv_lock);
-    global->invs = realloc(global->invs, (global->ninvs + 1) * sizeof(*global->invs));
-    struct invariant *inv = &global->invs[global->ninvs++];
-    inv->pc = ei->pc;
-    inv->pre = ei->pre;
-    if (ei->pre) {
-        global->inv_pre = true;
+    unsigned int i;
+    for (i = 0; i < global->ninvs; i++) {
+        if (global->invs[i].pc == ei->pc) {
+            break;
+        }
+    }
+    if (i == global->ninvs) {
+        struct invariant *inv = &global->invs[i];
+        inv->pc = ei->pc;
+        inv->pre = ei->pre;
+        if (ei->pre) {
+            global->inv_pre = true;
+        }
+        global->ninvs++;
     }
     mutex_release(&global->inv_lock);
 
@@ -4416,3 +4435,36 @@ void ops_init(struct global *global, struct engine *engine) {
         *p = fi;
     }
 }
+
+// Partial-order reduction (charm -p) assumes that a step that does not
+// access shared variables cannot be observed by other threads.  That is
+// not so if the program looks at the program counters of other threads,
+// as countLabel() does.
+bool ops_inspects_contexts(struct global *global){
+    for (unsigned int pc = 0; pc < global->code.len; pc++) {
+        struct instr *instr = &global->code.instrs[pc];
+        if (instr->oi->op == op_Nary) {
+            const struct env_Nary *en = instr->env;
+            if (en->fi->f == f_countLabel) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Allocate room for all invariants and finally predicates in the code
+void ops_predicates_alloc(struct global *global){
+    unsigned int ninvs = 0, nfinals = 0;
+    for (unsigned int pc = 0; pc < global->code.len; pc++) {
+        struct instr *instr = &global->code.instrs[pc];
+        if (instr->oi->op == op_Invariant) {
+            ninvs++;
+        }
+        else if (instr->oi->op == op_Finally) {
+            nfinals++;
+        }
+    }
+    global->invs = malloc((ninvs + 1) * sizeof(*global->invs));
+    global->finals = malloc((nfinals + 1) * sizeof(*global->finals));
+}
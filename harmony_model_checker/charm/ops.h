@@ -11,6 +11,8 @@
 #define MAX_ARGS         8
 
 void ops_init(struct global *global, struct engine *engine);
+bool ops_inspects_contexts(struct global *global);
+void ops_predicates_alloc(struct global *global);
 struct op_info *ops_get(char *opname, int size);
 
 struct step {
@@ -0,0 +1,372 @@
+#include "head.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "global.h"
+#include "value.h"
+#include "graph.h"
+#include "charm.h"
+#include "csr.h"
+#include "scc.h"
+
+#define SCC_CHUNK   1024        // #slots allocated at a time
+
+#define SCC_TOP(count, index)   (((uint64_t) (count) << 32) | (index))
+#define SCC_TOP_COUNT(t)        ((uint32_t) ((t) >> 32))
+#define SCC_TOP_INDEX(t)        ((uint32_t) (t))
+
+// The range of states that a worker starts with during trimming
+static inline void scc_range(struct scc_pool *pool, unsigned int worker,
+                                unsigned int *lo, unsigned int *hi){
+    *lo = (uint64_t) pool->nnodes * worker / pool->nworkers;
+    *hi = (uint64_t) pool->nnodes * (worker + 1) / pool->nworkers;
+}
+
+static inline struct scc_slot *scc_slot(struct scc_pool *pool, uint32_t index){
+    assert(index > 0);
+    index--;
+    return &pool->chunks[index / SCC_CHUNK][index % SCC_CHUNK];
+}
+
+struct scc_pool *scc_pool_new(struct global *global, unsigned int nworkers){
+    struct scc_pool *pool = new_alloc(struct scc_pool);
+    pool->global = global;
+    pool->nworkers = nworkers;
+    pool->nnodes = global->graph.size;
+
+    // Each partition pushes at most three ranges and produces at least
+    // one component, and each worker may have part of a chunk unused
+    pool->nchunks = (3 * (uint64_t) pool->nnodes + 1) / SCC_CHUNK + nworkers + 1;
+    pool->chunks = calloc(pool->nchunks, sizeof(*pool->chunks));
+#ifdef USE_ATOMIC
+    atomic_init(&pool->top, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->nslots, 0);
+    atomic_init(&pool->ncomponents, 0);
+
+    pool->trim = true;
+    pool->indegree = malloc(pool->nnodes * sizeof(*pool->indegree));
+    pool->outdegree = malloc(pool->nnodes * sizeof(*pool->outdegree));
+    pool->trimmed = malloc(pool->nnodes * sizeof(*pool->trimmed));
+    pool->nkept = calloc(nworkers, sizeof(*pool->nkept));
+    if (global->graph.csr == NULL) {
+        pool->nodes = malloc(global->graph.alloc_size * sizeof(*pool->nodes));
+    }
+#else
+    mutex_init(&pool->lock);
+#endif
+    return pool;
+}
+
+void scc_pool_free(struct scc_pool *pool){
+    for (unsigned int i = 0; i < pool->nchunks; i++) {
+        free(pool->chunks[i]);
+    }
+    free(pool->chunks);
+    free(pool->nkept);
+    free(pool);
+}
+
+// Count the edges to and from other states of the worker's states
+void scc_trim_init(struct scc_pool *pool, unsigned int worker){
+#ifdef USE_ATOMIC
+    struct graph *graph = &pool->global->graph;
+    struct graph_iter it;
+    uint32_t next;
+    unsigned int lo, hi;
+    scc_range(pool, worker, &lo, &hi);
+    for (unsigned int i = lo; i < hi; i++) {
+        uint32_t in = 0, out = 0;
+        graph_succ(graph, i, &it);
+        while (graph_next(&it, &next)) {
+            if (next != i) {
+                out++;
+            }
+        }
+        graph_pred(graph, i, &it);
+        while (graph_next(&it, &next)) {
+            if (next != i) {
+                in++;
+            }
+        }
+        atomic_init(&pool->indegree[i], in);
+        atomic_init(&pool->outdegree[i], out);
+        atomic_init(&pool->trimmed[i], false);
+    }
+#endif
+}
+
+#ifdef USE_ATOMIC
+
+struct scc_stack {
+    uint32_t *ids;
+    unsigned int size, alloc_size;
+};
+
+// Trim the given state unless another worker already did
+static void scc_trim_push(struct scc_pool *pool, struct scc_stack *stack, uint32_t id){
+    if (atomic_exchange(&pool->trimmed[id], true)) {
+        return;
+    }
+    if (stack->size == stack->alloc_size) {
+        stack->alloc_size = (stack->alloc_size + 1) * 2;
+        stack->ids = realloc(stack->ids, stack->alloc_size * sizeof(*stack->ids));
+    }
+    stack->ids[stack->size++] = id;
+}
+
+#endif
+
+// Remove the states without incoming or outgoing edges, starting from
+// the worker's own range of states.  Removing a state removes its edges,
+// which may leave its neighbors without incoming or outgoing edges.
+void scc_trim(struct scc_pool *pool, unsigned int worker){
+#ifdef USE_ATOMIC
+    struct graph *graph = &pool->global->graph;
+    struct graph_iter it;
+    uint32_t next;
+    struct scc_stack stack = { NULL, 0, 0 };
+    unsigned int lo, hi;
+    scc_range(pool, worker, &lo, &hi);
+    for (unsigned int i = lo; i < hi; i++) {
+        if (atomic_load(&pool->indegree[i]) == 0 || atomic_load(&pool->outdegree[i]) == 0) {
+            scc_trim_push(pool, &stack, i);
+        }
+        while (stack.size > 0) {
+            uint32_t id = stack.ids[--stack.size];
+            graph_succ(graph, id, &it);
+            while (graph_next(&it, &next)) {
+                if (next != id && atomic_fetch_sub(&pool->indegree[next], 1) == 1) {
+                    scc_trim_push(pool, &stack, next);
+                }
+            }
+            graph_pred(graph, id, &it);
+            while (graph_next(&it, &next)) {
+                if (next != id && atomic_fetch_sub(&pool->outdegree[next], 1) == 1) {
+                    scc_trim_push(pool, &stack, next);
+                }
+            }
+        }
+    }
+    free(stack.ids);
+#endif
+}
+
+// Count the states in the worker's range that were not trimmed
+void scc_trim_count(struct scc_pool *pool, unsigned int worker){
+#ifdef USE_ATOMIC
+    unsigned int lo, hi, n = 0;
+    scc_range(pool, worker, &lo, &hi);
+    for (unsigned int i = lo; i < hi; i++) {
+        if (!atomic_load_explicit(&pool->trimmed[i], memory_order_relaxed)) {
+            n++;
+        }
+    }
+    pool->nkept[worker] = n;
+#endif
+}
+
+// Move the states in the worker's range that were kept to the front, in
+// the same order, and the trimmed ones to the back.  Trimmed state number
+// i of the back is component i.
+void scc_trim_compact(struct scc_pool *pool, unsigned int worker){
+#ifdef USE_ATOMIC
+    struct global *global = pool->global;
+    struct csr *csr = global->graph.csr;
+    unsigned int lo, hi;
+    scc_range(pool, worker, &lo, &hi);
+
+    unsigned int nkept = 0, kept = 0;
+    for (unsigned int i = 0; i < pool->nworkers; i++) {
+        if (i == worker) {
+            kept = nkept;
+        }
+        nkept += pool->nkept[i];
+    }
+    unsigned int trimmed = nkept + (lo - kept);
+
+    for (unsigned int i = lo; i < hi; i++) {
+        bool t = atomic_load_explicit(&pool->trimmed[i], memory_order_relaxed);
+        unsigned int p = t ? trimmed++ : kept++;
+        if (csr != NULL) {
+            csr->perm[p] = i;
+            csr->pos[i] = p;
+            if (t) {
+                csr->component[i] = p - nkept;
+            }
+        }
+        else {
+            struct node *node = global->graph.nodes[i];
+            pool->nodes[p] = node;
+            node->id = p;
+            if (t) {
+                node->component = p - nkept;
+            }
+        }
+    }
+#endif
+}
+
+// Called by one worker after all states are compacted
+void scc_trim_done(struct scc_pool *pool){
+#ifdef USE_ATOMIC
+    struct global *global = pool->global;
+    unsigned int nkept = 0;
+    for (unsigned int i = 0; i < pool->nworkers; i++) {
+        nkept += pool->nkept[i];
+    }
+    pool->ntrimmed = pool->nnodes - nkept;
+    atomic_store(&pool->ncomponents, pool->ntrimmed);
+    if (global->graph.csr == NULL) {
+        free(global->graph.nodes);
+        global->graph.nodes = pool->nodes;
+        pool->nodes = NULL;
+    }
+    free(pool->indegree);
+    free(pool->outdegree);
+    free(pool->trimmed);
+    pool->indegree = pool->outdegree = NULL;
+    pool->trimmed = NULL;
+#endif
+}
+
+static uint32_t scc_slot_alloc(struct scc_pool *pool, struct scc_slots *slots){
+    uint32_t index = slots->free;
+    if (index != 0) {
+#ifdef USE_ATOMIC
+        slots->free = atomic_load_explicit(&scc_slot(pool, index)->next, memory_order_relaxed);
+#else
+        slots->free = scc_slot(pool, index)->next;
+#endif
+        return index;
+    }
+    if (slots->next == slots->last) {
+#ifdef USE_ATOMIC
+        unsigned int first = atomic_fetch_add(&pool->nslots, SCC_CHUNK);
+#else
+        mutex_acquire(&pool->lock);
+        unsigned int first = pool->nslots;
+        pool->nslots += SCC_CHUNK;
+        mutex_release(&pool->lock);
+#endif
+        assert(first / SCC_CHUNK < pool->nchunks);
+        pool->chunks[first / SCC_CHUNK] = malloc(SCC_CHUNK * sizeof(struct scc_slot));
+        slots->next = first + 1;
+        slots->last = first + 1 + SCC_CHUNK;
+    }
+    return slots->next++;
+}
+
+// Add a range of states to be partitioned
+void scc_pool_put(struct scc_pool *pool, struct scc_slots *slots, unsigned int start, unsigned int finish){
+    uint32_t index = scc_slot_alloc(pool, slots);
+    struct scc_slot *slot = scc_slot(pool, index);
+    slot->start = start;
+    slot->finish = finish;
+#ifdef USE_ATOMIC
+    atomic_fetch_add(&pool->pending, 1);
+    uint64_t top = atomic_load(&pool->top);
+    do {
+        atomic_store_explicit(&slot->next, SCC_TOP_INDEX(top), memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak(&pool->top, &top,
+                            SCC_TOP(SCC_TOP_COUNT(top) + 1, index)));
+#else
+    mutex_acquire(&pool->lock);
+    pool->pending++;
+    slot->next = pool->top;
+    pool->top = index;
+    mutex_release(&pool->lock);
+#endif
+}
+
+// Get a range of states to partition.  Returns false if there are none
+// left, nor any being partitioned by other workers that may produce more.
+bool scc_pool_get(struct scc_pool *pool, struct scc_slots *slots, unsigned int *start, unsigned int *finish){
+    struct scc_slot *slot;
+    uint32_t index;
+#ifdef USE_ATOMIC
+    uint64_t top = atomic_load(&pool->top);
+    for (;;) {
+        index = SCC_TOP_INDEX(top);
+        if (index == 0) {
+            if (atomic_load(&pool->pending) == 0) {
+                return false;
+            }
+            thread_yield();
+            top = atomic_load(&pool->top);
+            continue;
+        }
+
+        // The slot may be popped and reused by another worker before the
+        // exchange, in which case the counter in the top has changed
+        slot = scc_slot(pool, index);
+        uint32_t next = atomic_load_explicit(&slot->next, memory_order_relaxed);
+        if (atomic_compare_exchange_weak(&pool->top, &top,
+                            SCC_TOP(SCC_TOP_COUNT(top) + 1, next))) {
+            break;
+        }
+    }
+#else
+    for (;;) {
+        mutex_acquire(&pool->lock);
+        index = pool->top;
+        if (index != 0) {
+            slot = scc_slot(pool, index);
+            pool->top = slot->next;
+            mutex_release(&pool->lock);
+            break;
+        }
+        bool done = pool->pending == 0;
+        mutex_release(&pool->lock);
+        if (done) {
+            return false;
+        }
+        thread_yield();
+    }
+#endif
+    *start = slot->start;
+    *finish = slot->finish;
+
+    // The slot is now owned by this worker
+#ifdef USE_ATOMIC
+    atomic_store_explicit(&slot->next, slots->free, memory_order_relaxed);
+#else
+    slot->next = slots->free;
+#endif
+    slots->free = index;
+    return true;
+}
+
+// Called when a range obtained with scc_pool_get() has been partitioned
+// completely, including the ranges that the worker kept for itself
+void scc_pool_done(struct scc_pool *pool){
+#ifdef USE_ATOMIC
+    atomic_fetch_sub(&pool->pending, 1);
+#else
+    mutex_acquire(&pool->lock);
+    pool->pending--;
+    mutex_release(&pool->lock);
+#endif
+}
+
+// Allocate a component identifier
+unsigned int scc_pool_component(struct scc_pool *pool){
+#ifdef USE_ATOMIC
+    return atomic_fetch_add(&pool->ncomponents, 1);
+#else
+    mutex_acquire(&pool->lock);
+    unsigned int component = pool->ncomponents++;
+    mutex_release(&pool->lock);
+    return component;
+#endif
+}
+
+unsigned int scc_pool_ncomponents(struct scc_pool *pool){
+#ifdef USE_ATOMIC
+    return atomic_load(&pool->ncomponents);
+#else
+    return pool->ncomponents;
+#endif
+}
@@ -0,0 +1,91 @@
+#ifndef SRC_SCC_H
+#define SRC_SCC_H
+
+// Parallel decomposition of the Kripke graph into strongly connected
+// components.  This is done in two phases by all SCC workers together:
+//
+//  1. Trimming.  A state without incoming or without outgoing edges from
+//     or to other states is a component by itself, and removing it may
+//     make neighboring states trivial as well.  Each worker starts with a
+//     range of states and then follows the states it removes, using
+//     per-state degree counters that are decremented atomically.  The
+//     states that are left are then moved to the front of the graph table
+//     (or of the permutation of the compressed graph, see csr.h), and the
+//     trimmed states are numbered as the first components.
+//
+//  2. Forward-backward partitioning (graph_find_scc_one()) of the states
+//     that are left.  Each partition produces up to three new ranges of
+//     states.  Workers keep one and push the others on a shared stack
+//     that is lock-free: the top of the stack is a slot index packed
+//     together with a counter that changes on every update, so a slot
+//     that is popped and pushed again by another worker in the meantime
+//     is noticed.  The search ends when no ranges are on the stack or
+//     being partitioned.
+//
+// Trimming uses atomic operations and is skipped if those are not
+// available, in which case the stack is protected by a lock.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "hashtab.h"
+#include "thread.h"
+
+struct global;
+
+struct scc_slot {
+    hAtomic(uint32_t) next;     // next slot on the stack, or 0
+    unsigned int start, finish; // range of states
+};
+
+// Per worker slot allocation
+struct scc_slots {
+    uint32_t free;              // list of free slots, or 0
+    uint32_t next, last;        // unused slots in the worker's last chunk
+};
+
+struct scc_pool {
+    struct global *global;
+    unsigned int nworkers;
+    unsigned int nnodes;
+
+    // Stack of ranges that remain to be partitioned.  Slots are numbered
+    // starting from 1 and allocated in chunks.
+#ifdef USE_ATOMIC
+    hAtomic(uint64_t) top;      // counter and slot index of the top
+    hAtomic(unsigned int) pending;  // #ranges on the stack or being partitioned
+    hAtomic(unsigned int) nslots;   // #slots in all chunks
+    hAtomic(unsigned int) ncomponents;
+#else
+    mutex_t lock;
+    uint32_t top;
+    unsigned int pending, nslots, ncomponents;
+#endif
+    struct scc_slot **chunks;
+    unsigned int nchunks;
+
+    // Trimming
+    bool trim;                  // trimming is enabled
+#ifdef USE_ATOMIC
+    hAtomic(uint32_t) *indegree, *outdegree;
+    hAtomic(bool) *trimmed;
+#endif
+    unsigned int *nkept;        // per worker: #states kept
+    unsigned int ntrimmed;      // #states trimmed
+    struct node **nodes;        // new graph table after trimming
+    double trimmed_at;          // time at which trimming finished
+};
+
+struct scc_pool *scc_pool_new(struct global *global, unsigned int nworkers);
+void scc_pool_free(struct scc_pool *pool);
+void scc_trim_init(struct scc_pool *pool, unsigned int worker);
+void scc_trim(struct scc_pool *pool, unsigned int worker);
+void scc_trim_count(struct scc_pool *pool, unsigned int worker);
+void scc_trim_compact(struct scc_pool *pool, unsigned int worker);
+void scc_trim_done(struct scc_pool *pool);
+void scc_pool_put(struct scc_pool *pool, struct scc_slots *slots, unsigned int start, unsigned int finish);
+bool scc_pool_get(struct scc_pool *pool, struct scc_slots *slots, unsigned int *start, unsigned int *finish);
+void scc_pool_done(struct scc_pool *pool);
+unsigned int scc_pool_component(struct scc_pool *pool);
+unsigned int scc_pool_ncomponents(struct scc_pool *pool);
+
+#endif //SRC_SCC_H
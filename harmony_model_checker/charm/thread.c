@@ -124,8 +124,14 @@ void barrier_destroy(barrier_t *barrier){
     DeleteCriticalSection(&barrier->mutex);
 }
 
+void thread_yield(){
+    SwitchToThread();
+}
+
 #else // pthreads
 
+#include <sched.h>
+
 void thread_create(void (*f)(void *arg), void *arg){
     pthread_t tid;
     pthread_create(&tid, NULL, (void *(*)(void *)) f, arg);
@@ -179,6 +185,10 @@ void barrier_destroy(barrier_t *barrier){
     pthread_mutex_destroy(&barrier->mutex);
 }
 
+void thread_yield(){
+    sched_yield();
+}
+
 #endif
 
 unsigned int getNumCores(){
@@ -62,11 +62,34 @@ void *value_copy_extend(hvalue_t v, unsigned int inc, unsigned int *psize){
     return r;
 }
 
+// Create the value store (see value.h).  Sizes are initial only.
+struct dict **values_new(unsigned int nworkers){
+    static char *names[VALUE_NSHARDS] = {
+        "atoms", "sets", "dicts", "lists", "addresses", "contexts"
+    };
+    static unsigned int sizes[VALUE_NSHARDS] = {
+        1 << 10, 1 << 12, 1 << 14, 1 << 12, 1 << 10, 1 << 14
+    };
+    struct dict **values = calloc(VALUE_NSHARDS, sizeof(*values));
+    for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+        values[i] = dict_new(names[i], 0, sizes[i], nworkers, true);
+    }
+    return values;
+}
+
+unsigned long values_allocated(struct dict **values){
+    unsigned long total = 0;
+    for (unsigned int i = 0; i < VALUE_NSHARDS; i++) {
+        total += dict_allocated(values[i]);
+    }
+    return total;
+}
+
 hvalue_t value_put_atom(struct engine *engine, const void *p, unsigned int size){
     if (size == 0) {
         return VALUE_ATOM;
     }
-    void *q = dict_find(engine->values, engine->allocator, p, size, NULL);
+    void *q = dict_find(engine->values[VALUE_SHARD_ATOM], engine->allocator, p, size, NULL);
     return (hvalue_t) q | VALUE_ATOM;
 }
 
@@ -74,24 +97,58 @@ hvalue_t value_put_set(struct engine *engine, void *p, unsigned int size){
     if (size == 0) {
         return VALUE_SET;
     }
-    void *q = dict_find(engine->values, engine->allocator, p, size, NULL);
+    void *q = dict_find(engine->values[VALUE_SHARD_SET], engine->allocator, p, size, NULL);
     return (hvalue_t) q | VALUE_SET;
 }
 
+// Dicts and lists are not hashed as strings of bytes but as the sum of the
+// hashes of their entries (key/value pairs, or index/value pairs for lists).
+// That way a store, insert or delete only has to adjust the hash of the
+// original value rather than rehash all of the result.
+static inline uint32_t value_entry_hash(hvalue_t key, hvalue_t value){
+    uint64_t h = hash_mum(key ^ HASH_P1, value ^ HASH_P2);
+    return (uint32_t) (h ^ (h >> 32));
+}
+
+// Hash of a non-empty dict or list, as computed by one of the below
+static inline uint32_t value_hash(hvalue_t v){
+    return dict_retrieve_hash((void *) (v & ~VALUE_MASK));
+}
+
+static hvalue_t value_put_dict_hashed(struct engine *engine, void *p, unsigned int size, uint32_t hash){
+    void *q = dict_find_hashed(engine->values[VALUE_SHARD_DICT], engine->allocator, p, size, hash, NULL);
+    return (hvalue_t) q | VALUE_DICT;
+}
+
+static hvalue_t value_put_list_hashed(struct engine *engine, void *p, unsigned int size, uint32_t hash){
+    void *q = dict_find_hashed(engine->values[VALUE_SHARD_LIST], engine->allocator, p, size, hash, NULL);
+    return (hvalue_t) q | VALUE_LIST;
+}
+
 hvalue_t value_put_dict(struct engine *engine, void *p, unsigned int size){
     if (size == 0) {
         return VALUE_DICT;
     }
-    void *q = dict_find(engine->values, engine->allocator, p, size, NULL);
-    return (hvalue_t) q | VALUE_DICT;
+    hvalue_t *vals = p;
+    unsigned int n = size / sizeof(hvalue_t);
+    uint32_t hash = 0;
+    for (unsigned int i = 0; i < n; i += 2) {
+        hash += value_entry_hash(vals[i], vals[i + 1]);
+    }
+    return value_put_dict_hashed(engine, p, size, hash);
 }
 
 hvalue_t value_put_list(struct engine *engine, void *p, unsigned int size){
     if (size == 0) {
         return VALUE_LIST;
     }
-    void *q = dict_find(engine->values, engine->allocator, p, size, NULL);
-    return (hvalue_t) q | VALUE_LIST;
+    hvalue_t *vals = p;
+    unsigned int n = size / sizeof(hvalue_t);
+    uint32_t hash = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        hash += value_entry_hash(VALUE_TO_INT(i), vals[i]);
+    }
+    return value_put_list_hashed(engine, p, size, hash);
 }
 
 hvalue_t value_put_address(struct engine *engine, void *p, unsigned int size){
@@ -99,7 +156,7 @@ hvalue_t value_put_address(struct engine *engine, void *p, unsigned int size){
         return VALUE_ADDRESS_SHARED;
     }
     assert(size % sizeof(hvalue_t) == 0);
-    void *q = dict_find(engine->values, engine->allocator, p, size, NULL);
+    void *q = dict_find(engine->values[VALUE_SHARD_ADDRESS], engine->allocator, p, size, NULL);
     if (* (hvalue_t *) p == VALUE_PC_SHARED) {
         return (hvalue_t) q | VALUE_ADDRESS_SHARED;
     }
@@ -110,7 +167,7 @@ hvalue_t value_put_address(struct engine *engine, void *p, unsigned int size){
 
 hvalue_t value_put_context(struct engine *engine, struct context *ctx){
 	assert(ctx->pc >= 0);
-    void *q = dict_find(engine->values, engine->allocator, ctx, ctx_size(ctx), NULL);
+    void *q = dict_find(engine->values[VALUE_SHARD_CONTEXT], engine->allocator, ctx, ctx_size(ctx), NULL);
     if (ctx->eternal) {
         return (hvalue_t) q | VALUE_CONTEXT | VALUE_CONTEXT_ETERNAL;
     }
@@ -936,7 +993,7 @@ hvalue_t value_atom(struct engine *engine, struct dict *map){
     if (value->u.atom.len == 0) {
         return VALUE_ATOM;
     }
-    void *p = dict_find(engine->values, engine->allocator, value->u.atom.base, value->u.atom.len, NULL);
+    void *p = dict_find(engine->values[VALUE_SHARD_ATOM], engine->allocator, value->u.atom.base, value->u.atom.len, NULL);
     return (hvalue_t) p | VALUE_ATOM;
 }
 
@@ -959,10 +1016,9 @@ hvalue_t value_dict(struct engine *engine, struct dict *map){
     }
 
     // vals is sorted already by harmony compiler
-    void *p = dict_find(engine->values, engine->allocator, vals,
-                    value->u.list.nvals * sizeof(hvalue_t) * 2, NULL);
+    hvalue_t v = value_put_dict(engine, vals, value->u.list.nvals * sizeof(hvalue_t) * 2);
     free(vals);
-    return (hvalue_t) p | VALUE_DICT;
+    return v;
 }
 
 hvalue_t value_set(struct engine *engine, struct dict *map){
@@ -979,7 +1035,7 @@ hvalue_t value_set(struct engine *engine, struct dict *map){
     }
 
     // vals is sorted already by harmony compiler
-    void *p = dict_find(engine->values, engine->allocator, vals, value->u.list.nvals * sizeof(hvalue_t), NULL);
+    void *p = dict_find(engine->values[VALUE_SHARD_SET], engine->allocator, vals, value->u.list.nvals * sizeof(hvalue_t), NULL);
     free(vals);
     return (hvalue_t) p | VALUE_SET;
 }
@@ -996,9 +1052,9 @@ hvalue_t value_list(struct engine *engine, struct dict *map){
         assert(jv->type == JV_MAP);
         vals[i] = value_from_json(engine, jv->u.map);
     }
-    void *p = dict_find(engine->values, engine->allocator, vals, value->u.list.nvals * sizeof(hvalue_t), NULL);
+    hvalue_t v = value_put_list(engine, vals, value->u.list.nvals * sizeof(hvalue_t));
     free(vals);
-    return (hvalue_t) p | VALUE_LIST;
+    return v;
 }
 
 hvalue_t value_address(struct engine *engine, struct dict *map){
@@ -1090,46 +1146,97 @@ static bool align_test(){
 
 // Store key:value in the given dictionary and returns its value code
 // in *result.  May fail if allow_inserts is false and key does not exist
+// Dicts with more than this many entries are searched by bisection, as
+// their keys are sorted.  Smaller ones are scanned, which avoids most calls
+// to value_cmp() because keys can be compared by identity.
+#define DICT_BISECT     16
+
+// Find key in the key/value array of a dict with n entries.  Returns true
+// if found.  Either way, *index is set to where the key is or should go.
+static bool value_dict_index(const hvalue_t *vals, unsigned int n, hvalue_t key, unsigned int *index){
+    unsigned int i;
+    if (n > DICT_BISECT) {
+        unsigned int hi = n;
+        i = 0;
+        while (i < hi) {
+            unsigned int mid = (i + hi) / 2;
+            if (value_cmp(vals[2 * mid], key) < 0) {
+                i = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        *index = 2 * i;
+        return i < n && vals[2 * i] == key;
+    }
+    for (i = 0; i < n; i++) {
+        if (vals[2 * i] == key) {
+            *index = 2 * i;
+            return true;
+        }
+        if (value_cmp(vals[2 * i], key) > 0) {
+            break;
+        }
+    }
+    *index = 2 * i;
+    return false;
+}
+
+// Like value_dict_index(), but only to see if the key is there.  Returns
+// the index of the key, or -1 if not found.
+static int value_dict_find(const hvalue_t *vals, unsigned int n, hvalue_t key){
+    unsigned int index;
+    if (n > DICT_BISECT) {
+        return value_dict_index(vals, n, key, &index) ? (int) index : -1;
+    }
+    for (unsigned int i = 0; i < 2 * n; i += 2) {
+        if (vals[i] == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 bool value_dict_trystore(struct engine *engine, hvalue_t dict, hvalue_t key, hvalue_t value, bool allow_inserts, hvalue_t *result){
     assert(VALUE_TYPE(dict) == VALUE_DICT);
 
     hvalue_t *vals;
     unsigned int size;
+    uint32_t hash;
     if (dict == VALUE_DICT) {
         vals = NULL;
         size = 0;
+        hash = 0;
     }
     else {
         vals = value_get(dict, &size);
         size /= sizeof(hvalue_t);
         assert(size % 2 == 0);
+        hash = value_hash(dict);
     }
 
     unsigned int i;
-    for (i = 0; i < size; i += 2) {
-        if (vals[i] == key) {
-            if (vals[i + 1] == value) {
-                *result = dict;
-                return true;
-            }
-            int n = size * sizeof(hvalue_t);
+    if (value_dict_index(vals, size / 2, key, &i)) {
+        if (vals[i + 1] == value) {
+            *result = dict;
+            return true;
+        }
+        int n = size * sizeof(hvalue_t);
 #ifdef HEAP_ALLOC
-            hvalue_t *copy = malloc(size * sizeof(hvalue_t));
+        hvalue_t *copy = malloc(size * sizeof(hvalue_t));
 #else
-            hvalue_t copy[size];
+        hvalue_t copy[size];
 #endif
-            memcpy(copy, vals, n);
-            copy[i + 1] = value;
-            hvalue_t v = value_put_dict(engine, copy, n);
+        memcpy(copy, vals, n);
+        copy[i + 1] = value;
+        hash += value_entry_hash(key, value) - value_entry_hash(key, vals[i + 1]);
+        hvalue_t v = value_put_dict_hashed(engine, copy, n, hash);
 #ifdef HEAP_ALLOC
-            free(copy);
+        free(copy);
 #endif
-            *result = v;
-            return true;
-        }
-        if (value_cmp(vals[i], key) > 0) {
-            break;
-        }
+        *result = v;
+        return true;
     }
 
     if (!allow_inserts) {
@@ -1146,7 +1253,8 @@ bool value_dict_trystore(struct engine *engine, hvalue_t dict, hvalue_t key, hva
     nvals[i] = key;
     nvals[i+1] = value;
     memcpy(&nvals[i+2], &vals[i], (size - i) * sizeof(hvalue_t));
-    hvalue_t v = value_put_dict(engine, nvals, n);
+    hash += value_entry_hash(key, value);
+    hvalue_t v = value_put_dict_hashed(engine, nvals, n, hash);
 #ifdef HEAP_ALLOC
     free(nvals);
 #endif
@@ -1171,32 +1279,29 @@ bool value_trystore(struct engine *engine, hvalue_t root, hvalue_t key, hvalue_t
     hvalue_t *vals = value_get(root, &size);
     unsigned int n = size / sizeof(hvalue_t);
 
+    uint32_t hash = n == 0 ? 0 : value_hash(root);
     if (VALUE_TYPE(root) == VALUE_DICT) {
         assert(n % 2 == 0);
         unsigned int i;
-        for (i = 0; i < n; i += 2) {
-            if (vals[i] == key) {
-                if (vals[i + 1] == value) {
-                    *result = root;
-                    return true;
-                }
+        if (value_dict_index(vals, n / 2, key, &i)) {
+            if (vals[i + 1] == value) {
+                *result = root;
+                return true;
+            }
 #ifdef HEAP_ALLOC
-                hvalue_t *nvals = malloc(n * sizeof(hvalue_t));
+            hvalue_t *nvals = malloc(n * sizeof(hvalue_t));
 #else
-                hvalue_t nvals[n];
+            hvalue_t nvals[n];
 #endif
-                memcpy(nvals, vals, size);
-                nvals[i + 1] = value;
-                hvalue_t v = value_put_dict(engine, nvals, size);
+            memcpy(nvals, vals, size);
+            nvals[i + 1] = value;
+            hash += value_entry_hash(key, value) - value_entry_hash(key, vals[i + 1]);
+            hvalue_t v = value_put_dict_hashed(engine, nvals, size, hash);
 #ifdef HEAP_ALLOC
-                free(nvals);
+            free(nvals);
 #endif
-                *result = v;
-                return true;
-            }
-            if (value_cmp(vals[i], key) > 0) {
-                break;
-            }
+            *result = v;
+            return true;
         }
 
         if (!allow_inserts) {
@@ -1213,7 +1318,8 @@ bool value_trystore(struct engine *engine, hvalue_t root, hvalue_t key, hvalue_t
         nvals[i] = key;
         nvals[i+1] = value;
         memcpy(&nvals[i+2], &vals[i], (n - i) * sizeof(hvalue_t));
-        hvalue_t v = value_put_dict(engine, nvals, size);
+        hash += value_entry_hash(key, value);
+        hvalue_t v = value_put_dict_hashed(engine, nvals, size, hash);
 #ifdef HEAP_ALLOC
         free(nvals);
 #endif
@@ -1242,7 +1348,9 @@ bool value_trystore(struct engine *engine, hvalue_t root, hvalue_t key, hvalue_t
                 return true;
             }
             nsize = size;
+            hash -= value_entry_hash(key, vals[index]);
         }
+        hash += value_entry_hash(key, value);
 #ifdef HEAP_ALLOC
         hvalue_t *nvals = malloc(nsize);
 #else
@@ -1250,7 +1358,7 @@ bool value_trystore(struct engine *engine, hvalue_t root, hvalue_t key, hvalue_t
 #endif
         memcpy(nvals, vals, size);
         nvals[index] = value;
-        hvalue_t v = value_put_list(engine, nvals, nsize);
+        hvalue_t v = value_put_list_hashed(engine, nvals, nsize, hash);
 #ifdef HEAP_ALLOC
         free(nvals);
 #endif
@@ -1284,18 +1392,8 @@ hvalue_t value_dict_load(hvalue_t dict, hvalue_t key){
         assert(size % 2 == 0);
     }
 
-    unsigned int i;
-    for (i = 0; i < size; i += 2) {
-        if (vals[i] == key) {
-            return vals[i + 1];
-        }
-        /*
-            if (value_cmp(vals[i], key) > 0) {
-                break;
-            }
-        */
-    }
-    return 0;
+    int i = value_dict_find(vals, size / 2, key);
+    return i < 0 ? 0 : vals[i + 1];
 }
 
 hvalue_t value_dict_remove(struct engine *engine, hvalue_t dict, hvalue_t key){
@@ -1314,28 +1412,23 @@ hvalue_t value_dict_remove(struct engine *engine, hvalue_t dict, hvalue_t key){
         return vals[0] == key ? VALUE_DICT : dict;
     }
 
-    for (unsigned int i = 0; i < size; i += 2) {
-        if (vals[i] == key) {
-            int n = (size - 2) * sizeof(hvalue_t);
+    int i = value_dict_find(vals, size / 2, key);
+    if (i >= 0) {
+        int n = (size - 2) * sizeof(hvalue_t);
 #ifdef HEAP_ALLOC
-            hvalue_t *copy = malloc((size - 2) * sizeof(hvalue_t));
+        hvalue_t *copy = malloc((size - 2) * sizeof(hvalue_t));
 #else
-            hvalue_t copy[size - 2];
+        hvalue_t copy[size - 2];
 #endif
-            memcpy(copy, vals, i * sizeof(hvalue_t));
-            memcpy(&copy[i], &vals[i+2],
-                   (size - i - 2) * sizeof(hvalue_t));
-            hvalue_t v = value_put_dict(engine, copy, n);
+        memcpy(copy, vals, i * sizeof(hvalue_t));
+        memcpy(&copy[i], &vals[i+2],
+               (size - i - 2) * sizeof(hvalue_t));
+        uint32_t hash = value_hash(dict) - value_entry_hash(key, vals[i + 1]);
+        hvalue_t v = value_put_dict_hashed(engine, copy, n, hash);
 #ifdef HEAP_ALLOC
-            free(copy);
+        free(copy);
 #endif
-            return v;
-        }
-        /*
-            if (value_cmp(vals[i], key) > 0) {
-                assert(false);
-            }
-        */
+        return v;
     }
 
     return dict;
@@ -1358,28 +1451,23 @@ hvalue_t value_remove(struct engine *engine, hvalue_t root, hvalue_t key){
             return vals[0] == key ? VALUE_DICT : root;
         }
 
-        for (unsigned i = 0; i < n; i += 2) {
-            if (vals[i] == key) {
-                size -= 2 * sizeof(hvalue_t);
+        int i = value_dict_find(vals, n / 2, key);
+        if (i >= 0) {
+            size -= 2 * sizeof(hvalue_t);
 #ifdef HEAP_ALLOC
-                hvalue_t *copy = malloc(size);
+            hvalue_t *copy = malloc(size);
 #else
-                hvalue_t copy[size / sizeof(hvalue_t)];
+            hvalue_t copy[size / sizeof(hvalue_t)];
 #endif
-                memcpy(copy, vals, i * sizeof(hvalue_t));
-                memcpy(&copy[i], &vals[i+2],
-                       (n - i - 2) * sizeof(hvalue_t));
-                hvalue_t v = value_put_dict(engine, copy, size);
+            memcpy(copy, vals, i * sizeof(hvalue_t));
+            memcpy(&copy[i], &vals[i+2],
+                   (n - i - 2) * sizeof(hvalue_t));
+            uint32_t hash = value_hash(root) - value_entry_hash(key, vals[i + 1]);
+            hvalue_t v = value_put_dict_hashed(engine, copy, size, hash);
 #ifdef HEAP_ALLOC
-                free(copy);
+            free(copy);
 #endif
-                return v;
-            }
-            /* Not worth it
-                if (value_cmp(vals[i], key) > 0) {
-                    assert(false);
-                }
-            */
+            return v;
         }
     }
     else {
@@ -1454,16 +1542,10 @@ bool value_tryload(
         size /= sizeof(hvalue_t);
         assert(size % 2 == 0);
 
-        for (unsigned int i = 0; i < size; i += 2) {
-            if (vals[i] == key) {
-                *result = vals[i + 1];
-                return true;
-            }
-            /*
-                if (value_cmp(vals[i], key) > 0) {
-                    break;
-                }
-            */
+        int i = value_dict_find(vals, size / 2, key);
+        if (i >= 0) {
+            *result = vals[i + 1];
+            return true;
         }
     }
 
@@ -1588,6 +1670,7 @@ char *json_escape_value(hvalue_t v){
 void context_remove(struct state *state, hvalue_t ctx){
     for (unsigned int i = 0; i < state->bagsize; i++) {
         if (state_contexts(state)[i] == ctx) {
+            state->baghash -= context_hash(ctx);
             if (multiplicities(state)[i] > 1) {
                 multiplicities(state)[i]--;
             }
@@ -1609,6 +1692,7 @@ bool context_add(struct state *state, hvalue_t ctx){
     for (i = 0; i < state->bagsize; i++) {
         if (state_contexts(state)[i] == ctx) {
             multiplicities(state)[i]++;
+            state->baghash += context_hash(ctx);
             return true;
         }
         if (state_contexts(state)[i] > ctx) {
@@ -1630,6 +1714,7 @@ bool context_add(struct state *state, hvalue_t ctx){
                     (state->bagsize - i) * sizeof(hvalue_t) + i);
 
     state->bagsize++;
+    state->baghash += context_hash(ctx);
     state_contexts(state)[i] = ctx;
     multiplicities(state)[i] = 1;
     return true;
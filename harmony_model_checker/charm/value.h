@@ -5,6 +5,7 @@
 #include "global.h"
 #include "strbuf.h"
 #include "charm.h"
+#include "hash.h"
 
 #define MAX_CONTEXT_STACK   250        // maximum size of context stack
 #define MAX_CONTEXT_BAG       32        // maximum number of distinct contexts
@@ -14,6 +15,7 @@ typedef struct state {
     hvalue_t pre;         // "pre" state (same as vars in non-choosing states)
     hvalue_t choosing;    // context that is choosing if non-zero
     hvalue_t stopbag;     // bag of stopped contexts (to detect deadlock)
+    uint64_t baghash;     // sum of context_hash() over the bag (see state_hash)
     uint32_t dfa_state;   // state of input dfa
     uint16_t tid_gen;     // thread id generator
 
@@ -27,6 +29,19 @@ typedef struct state {
 #define multiplicities(s)   ((uint8_t *) &state_contexts(s)[(s)->bagsize])
 #define state_size(s)       (sizeof(struct state) + (s)->bagsize * (sizeof(hvalue_t) + 1))
 
+// The hash of a state is computed from its fixed-size header only.  The
+// bag of contexts is represented there by baghash, which context_add()
+// and context_remove() keep up to date.  Because it is a sum, it does not
+// depend on the order in which contexts were added, and equal bags have
+// equal hashes.
+static inline uint64_t context_hash(hvalue_t ctx){
+    return hash_mum(ctx ^ HASH_P1, HASH_P2);
+}
+
+static inline uint64_t state_hash(const struct state *s){
+    return hash64((const char *) s, sizeof(struct state));
+}
+
 typedef struct context {   // context value
     hvalue_t vars;            // method-local variables
     uint16_t pc;              // program counter
@@ -68,6 +83,8 @@ hvalue_t value_put_dict(struct engine *engine, void *p, unsigned int size);
 hvalue_t value_put_list(struct engine *engine, void *p, unsigned int size);
 hvalue_t value_put_address(struct engine *engine, void *p, unsigned int size);
 hvalue_t value_put_context(struct engine *engine, struct context *ctx);
+struct dict **values_new(unsigned int nworkers);
+unsigned long values_allocated(struct dict **values);
 char *value_string(hvalue_t v);
 char *indices_string(const hvalue_t *vec, int size);
 char *value_json(hvalue_t v, struct global *global);
@@ -93,6 +110,19 @@ void strbuf_value_json(strbuf *sb, hvalue_t v, struct global *global);
 
 #define VALUE_CONTEXT_ETERNAL   ((hvalue_t) 1 << 48)
 
+// The value store is split into shards by type, each a dictionary with its
+// own size and growth.  Contexts are interned after every step, so this
+// keeps them from slowing down lookups of other values.  Values are still
+// pointers to dictionary entries, so it does not matter which shard a
+// value is in when it is retrieved.
+#define VALUE_SHARD_ATOM        0
+#define VALUE_SHARD_SET         1
+#define VALUE_SHARD_DICT        2
+#define VALUE_SHARD_LIST        3
+#define VALUE_SHARD_ADDRESS     4
+#define VALUE_SHARD_CONTEXT     5
+#define VALUE_NSHARDS           6
+
 #define VALUE_FALSE     VALUE_BOOL
 #define VALUE_TRUE      ((1 << VALUE_BITS) | VALUE_BOOL)
 
@@ -41,6 +41,12 @@ args.add_argument("-i", "--intf", type=str, metavar="expr",
                   help="specify in interface function")
 args.add_argument("-s", action="store_true",
                   help="silent (do not print periodic status updates)")
+args.add_argument("--first-failure", action="store_true",
+                  help="stop at the first safety or invariant violation")
+args.add_argument("--max-memory", type=int, metavar="MB",
+                  help="limit the memory used by the model checker")
+args.add_argument("--on-the-fly", action="store_true",
+                  help="check for termination during a depth-first search")
 args.add_argument("-v", "--version", action="store_true",
                   help="print version number")
 args.add_argument("-o", action='append', type=pathlib.Path,
@@ -111,6 +117,12 @@ def handle_hvm(ns, output_files, parse_code_only, code, scope):
         charm_options.append("-D")
     if ns.R:
         charm_options.append("-R")
+    if ns.first_failure:
+        charm_options.append("--first-failure")
+    if ns.max_memory:
+        charm_options.append("--max-memory=%d" % ns.max_memory)
+    if ns.on_the_fly:
+        charm_options.append("--on-the-fly")
 
     # see if there is a configuration file
     if code is not None: